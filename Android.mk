@@ -20,6 +20,12 @@
 #
 # To specify additional include paths (for NDK builds) set the following var:
 #
+# To generate codecs for only some messages, set LIBFREESPACE_MESSAGES to a
+# comma separated list of message names and HID versions (v0, v1, v2).
+#
+# To generate codecs for a single HID protocol version, set
+# LIBFREESPACE_HID_VERSION to 0, 1 or 2.
+#
 
 #
 # Exports
@@ -50,7 +56,7 @@ LIBFREESPACE_MSG_GEN := $(LIBFREESPACE_GEN_DIR)/.msg
 
 $(LIBFREESPACE_MSG_GEN) : $(LIBFREESPACE_MSG_GEN_SCRIPT) $(LIBFREESPACE_MSG_GEN_MSG_FILE)  $(LIBFREESPACE_EXTRA_MSG_FILE)
 	@echo "libfreespace <= Generating Freespace Messages"
-	@python $(LIBFREESPACE_MSG_GEN_SCRIPT) -I $(LIBFREESPACE_GEN_DIR)/include/ -s $(LIBFREESPACE_GEN_DIR) $(LIBFREESPACE_MSG_GEN_MSG_FILE)  $(LIBFREESPACE_EXTRA_MSG_FILE)
+	@python $(LIBFREESPACE_MSG_GEN_SCRIPT) -I $(LIBFREESPACE_GEN_DIR)/include/ -s $(LIBFREESPACE_GEN_DIR) $(if $(LIBFREESPACE_MESSAGES),-m "$(LIBFREESPACE_MESSAGES)") $(if $(LIBFREESPACE_HID_VERSION),-H $(LIBFREESPACE_HID_VERSION)) $(LIBFREESPACE_MSG_GEN_MSG_FILE)  $(LIBFREESPACE_EXTRA_MSG_FILE)
 	@touch $(LIBFREESPACE_MSG_GEN)
 
 # Outputs:
@@ -70,7 +76,7 @@ $(LIBFREESPACE_CONF_FILE) : $(LOCAL_PATH)/Android.mk $(LIBFREESPACE_MSG_GEN)
 	@echo "libfreespace <= Creating Config File"
 	@echo "#define LIBFREESPACE_VERSION \"0.7.0\"	" > $@
 
-LOCAL_SRC_FILES := linux/freespace_hidraw.c common/freespace_deviceTable.c
+LOCAL_SRC_FILES := linux/freespace_hidraw.c common/freespace_deviceTable.c common/freespace_router.c
 
 ifndef NDK_ROOT
 LOCAL_GENERATED_SOURCES := $(LIBFREESPACE_CONF_FILE) $(LIBFREESPACE_MSG_GEN_SRCS)
@@ -94,6 +100,7 @@ LOCAL_CFLAGS += -DFREESPACE_LITTLE_ENDIAN
 
 LOCAL_C_INCLUDES += \
 	$(LOCAL_PATH)/include \
+	$(LOCAL_PATH)/common \
 	$(LIBFREESPACE_GEN_DIR)/include/ \
 	$(LIBFREESPACE_ADDITIONAL_INCLUDES)
 
@@ -0,0 +1,76 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FREESPACE_BENCH_H_
+#define FREESPACE_BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Not every program uses every helper, so they are inline to keep
+// -Wunused-function quiet.
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define BENCH_INLINE static __inline
+#else
+#define BENCH_INLINE static inline
+#endif
+
+// Wall clock time in seconds from an arbitrary start.
+BENCH_INLINE double benchSeconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+// Print the throughput of items processed in seconds.
+BENCH_INLINE void benchReport(const char* name, double items, double seconds) {
+    printf("%-44s %14.0f /s\n", name, items / seconds);
+}
+
+// Print a failed equivalence check and exit.
+BENCH_INLINE void benchFail(const char* what) {
+    fprintf(stderr, "mismatch: %s\n", what);
+    exit(1);
+}
+
+// Fill a buffer with reproducible pseudo-random bytes.
+BENCH_INLINE void benchFill(unsigned char* buf, int length, unsigned int seed) {
+    int i;
+    for (i = 0; i < length; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (unsigned char) (seed >> 16);
+    }
+}
+
+#endif /* FREESPACE_BENCH_H_ */
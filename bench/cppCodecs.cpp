@@ -0,0 +1,174 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares the C++ codecs in freespace_codecs.hpp with the C codecs: typed
+ * decode and encode of one message, and decoding a mix of reports through
+ * freespace::dispatch() against freespace_decode_message() and a switch.
+ * cppCodecsMatch.cpp checks that the two give the same results.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.hpp>
+#include <string.h>
+
+#define REPORT_COUNT 4096
+#define REPORT_SIZE 64
+#define ROUNDS 500
+
+// BodyFrame, UserFrame, MotionEngineOutput and DceOutV4T0
+static const uint8_t reportIds[] = {32, 33, 38, 41};
+static const uint8_t reportSizes[] = {22, 22, 54, 20};
+
+static uint8_t reports[REPORT_COUNT][REPORT_SIZE];
+static int lengths[REPORT_COUNT];
+
+static void makeReports(void) {
+    for (int i = 0; i < REPORT_COUNT; i++) {
+        int kind = i % sizeof(reportIds);
+        benchFill(reports[i], REPORT_SIZE, i + 1);
+        reports[i][0] = reportIds[kind];
+        reports[i][1] = reportSizes[kind];
+        if (reportIds[kind] == 41) {
+            reports[i][4] = 0; // DceOutV4T0 sub ID
+        }
+        lengths[i] = reportSizes[kind];
+    }
+}
+
+// The work done per message on both paths.
+struct Handler {
+    int sum;
+
+    void operator()(const freespace::BodyFrame& m) { sum += m.deltaX; }
+    void operator()(const freespace::UserFrame& m) { sum += m.angularPosA; }
+    void operator()(const freespace::MotionEngineOutput& m) { sum += m.sequenceNumber; }
+    void operator()(const freespace::DceOutV4T0& m) { sum += m.sampleBase; }
+};
+
+static int handleC(const struct freespace_message& m) {
+    switch (m.messageType) {
+        case FREESPACE_MESSAGE_BODYFRAME:
+            return m.bodyFrame.deltaX;
+        case FREESPACE_MESSAGE_USERFRAME:
+            return m.userFrame.angularPosA;
+        case FREESPACE_MESSAGE_MOTIONENGINEOUTPUT:
+            return m.motionEngineOutput.sequenceNumber;
+        case FREESPACE_MESSAGE_DCEOUTV4T0:
+            return m.dceOutV4T0.sampleBase;
+        default:
+            return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const double items = (double) ROUNDS * REPORT_COUNT;
+    struct freespace_message m;
+    freespace::UserFrame userFrame;
+    freespace::DataModeControlV2Request request;
+    uint8_t out[REPORT_SIZE];
+    Handler handler = {0};
+    volatile int sink = 0;
+    int sum;
+    double start;
+
+    makeReports();
+
+    // The paths must agree before their speed means anything.
+    sum = 0;
+    for (int i = 0; i < REPORT_COUNT; i++) {
+        if (freespace_decode_message(reports[i], lengths[i], &m, 2) != FREESPACE_SUCCESS) {
+            benchFail("freespace_decode_message rejected a report");
+        }
+        sum += handleC(m);
+        if (freespace::dispatch<2>(reports[i], lengths[i], handler) != 1) {
+            benchFail("freespace::dispatch dropped a report");
+        }
+    }
+    if (sum != handler.sum) {
+        benchFail("freespace::dispatch vs freespace_decode_message");
+    }
+
+    printf("HID protocol version 2, %d reports of 4 message types\n", REPORT_COUNT);
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 1; i < REPORT_COUNT; i += 4) {
+            freespace_decodeUserFrame(reports[i], lengths[i], &m, 2);
+            sink += m.userFrame.deltaX;
+        }
+    }
+    benchReport("freespace_decodeUserFrame (reports)", items / 4, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 1; i < REPORT_COUNT; i += 4) {
+            freespace::decode<freespace::UserFrame, 2>(reports[i], lengths[i], userFrame);
+            sink += userFrame.deltaX;
+        }
+    }
+    benchReport("freespace::decode<UserFrame, 2> (reports)", items / 4, benchSeconds() - start);
+
+    memset(&m, 0, sizeof(m));
+    m.messageType = FREESPACE_MESSAGE_DATAMODECONTROLV2REQUEST;
+    m.ver = 2;
+    m.dest = 1;
+    memset(&request, 0, sizeof(request));
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < REPORT_COUNT; i++) {
+            m.dataModeControlV2Request.packetSelect = (uint8_t) i;
+            sink += freespace_encode_message(&m, out, sizeof(out));
+            sink += out[5];
+        }
+    }
+    benchReport("freespace_encode_message (reports)", items, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < REPORT_COUNT; i++) {
+            request.packetSelect = (uint8_t) i;
+            sink += freespace::encode<freespace::DataModeControlV2Request, 2>(request, out, sizeof(out), 1);
+            sink += out[5];
+        }
+    }
+    benchReport("freespace::encode<DataModeControlV2Request>", items, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < REPORT_COUNT; i++) {
+            freespace_decode_message(reports[i], lengths[i], &m, 2);
+            sink += handleC(m);
+        }
+    }
+    benchReport("freespace_decode_message + switch (reports)", items, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < REPORT_COUNT; i++) {
+            freespace::dispatch<2>(reports[i], lengths[i], handler);
+        }
+    }
+    sink += handler.sum;
+    benchReport("freespace::dispatch<2> (reports)", items, benchSeconds() - start);
+
+    return 0;
+}
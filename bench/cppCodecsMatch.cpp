@@ -0,0 +1,180 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Checks that the C++ codecs in freespace_codecs.hpp give the same results as
+ * the C codecs. Every report ID and sub ID of every HID protocol version is
+ * decoded from random bytes through both, and a set of request messages is
+ * encoded from random fields through both.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.hpp>
+#include <string.h>
+
+#define REPORT_SIZE 64
+#define SUB_ID_COUNT 128
+
+// The checks of particular message types need every message of their HID
+// protocol version to be generated.
+#ifndef CPPCODECS_MATCH_ALLOWLIST
+#if !defined(FREESPACE_HID_VERSION_ONLY) || FREESPACE_HID_VERSION_ONLY == 1
+#define CHECK_V1_TYPES
+#endif
+#if !defined(FREESPACE_HID_VERSION_ONLY) || FREESPACE_HID_VERSION_ONLY == 2
+#define CHECK_V2_TYPES
+#endif
+#endif
+
+static int failures = 0;
+
+static void fail(const char* what, int ver, const uint8_t* report) {
+    fprintf(stderr, "mismatch: %s, version %d, report %d sub ID %d\n", what, ver, report[0], report[ver == 2 ? 4 : 1]);
+    failures++;
+}
+
+// Checks each message type the C++ dispatcher routes against the C decode of
+// the same report. The fields are compared by decoding the report again into
+// zeroed storage, so that struct padding compares equal.
+template <int Ver>
+struct DecodeCheck {
+    const uint8_t* report;
+    const struct freespace_message* c;
+
+    template <typename Message>
+    void operator()(const Message&) {
+        struct freespace_message cpp;
+
+        if (c->messageType != Message::messageType) {
+            fail("message type", Ver, report);
+            return;
+        }
+        // Every member of the union starts at the same address.
+        memset(&cpp, 0, sizeof(cpp));
+        Message& s = reinterpret_cast<Message&>(cpp.userFrame);
+        if (freespace::decode<Message, Ver>(report, REPORT_SIZE, s) != FREESPACE_SUCCESS ||
+            memcmp(&c->userFrame, &s, sizeof(s)) != 0) {
+            fail("decoded fields", Ver, report);
+        }
+    }
+};
+
+template <int Ver>
+static int checkDecode(void) {
+    uint8_t report[REPORT_SIZE];
+    int decoded = 0;
+
+    for (int id = 0; id < 256; id++) {
+        for (int subId = 0; subId < SUB_ID_COUNT; subId++) {
+            struct freespace_message m;
+            DecodeCheck<Ver> check = {report, &m};
+            int rc;
+            int cppRc;
+
+            benchFill(report, REPORT_SIZE, id * SUB_ID_COUNT + subId + 1);
+            report[0] = (uint8_t) id;
+            report[Ver == 2 ? 4 : 1] = (uint8_t) subId;
+            memset(&m, 0, sizeof(m));
+            rc = freespace_decode_message(report, REPORT_SIZE, &m, Ver);
+            cppRc = freespace::dispatch<Ver>(report, REPORT_SIZE, check);
+            if ((rc == FREESPACE_SUCCESS) != (cppRc == 1)) {
+                fail("decoded by only one of C and C++", Ver, report);
+            }
+            if (rc == FREESPACE_SUCCESS) {
+                decoded++;
+            }
+        }
+    }
+    return decoded;
+}
+
+// Encodes random fields of Message through the C and C++ codecs.
+template <typename Message, int Ver, typename CStruct>
+static void checkEncode(CStruct freespace_message::* member) {
+    for (int i = 0; i < 64; i++) {
+        struct freespace_message m;
+        Message s;
+        uint8_t cReport[REPORT_SIZE];
+        uint8_t cppReport[REPORT_SIZE];
+        int rc;
+        int cppRc;
+
+        memset(&m, 0, sizeof(m));
+        benchFill((unsigned char*) &(m.*member), sizeof(CStruct), i + 1);
+        m.messageType = Message::messageType;
+        m.ver = Ver;
+        m.dest = (uint8_t) i;
+        static_cast<CStruct&>(s) = m.*member;
+
+        memset(cReport, 0, sizeof(cReport));
+        memset(cppReport, 0, sizeof(cppReport));
+        rc = freespace_encode_message(&m, cReport, sizeof(cReport));
+        cppRc = freespace::encode<Message, Ver>(s, cppReport, sizeof(cppReport), m.dest, 0);
+        if (rc != cppRc || memcmp(cReport, cppReport, sizeof(cReport)) != 0) {
+            fail("encoded report", Ver, cReport);
+        }
+    }
+}
+
+#ifdef CHECK_V2_TYPES
+// Handlers passed to dispatch() as temporaries and as const objects.
+static void checkHandlerKinds(void) {
+    uint8_t report[REPORT_SIZE];
+    int calls = 0;
+
+    benchFill(report, REPORT_SIZE, 1);
+    report[0] = 33; // UserFrame
+    report[1] = 22;
+    freespace::dispatch<2>(report, REPORT_SIZE, freespace::overload(
+        [&calls](const freespace::UserFrame&) { calls++; },
+        [&calls](const freespace::BodyFrame&) { calls += 100; }));
+    const auto handler = freespace::overload([&calls](const freespace::UserFrame&) { calls++; });
+    freespace::dispatch(report, REPORT_SIZE, 2, handler);
+    if (calls != 2) {
+        fail("handler calls", 2, report);
+    }
+}
+#endif
+
+int main(int argc, char* argv[]) {
+#ifdef FREESPACE_HID_VERSION_ONLY
+    int decoded = checkDecode<FREESPACE_HID_VERSION_ONLY>();
+#else
+    int decoded = checkDecode<0>() + checkDecode<1>() + checkDecode<2>();
+#endif
+
+#ifdef CHECK_V1_TYPES
+    checkEncode<freespace::LEDSetRequest, 1>(&freespace_message::lEDSetRequest);
+    checkEncode<freespace::DataModeRequest, 1>(&freespace_message::dataModeRequest);
+#endif
+
+#ifdef CHECK_V2_TYPES
+    checkHandlerKinds();
+
+    checkEncode<freespace::LEDSetRequest, 2>(&freespace_message::lEDSetRequest);
+    checkEncode<freespace::FRSReadRequest, 2>(&freespace_message::fRSReadRequest);
+    checkEncode<freespace::FRSWriteData, 2>(&freespace_message::fRSWriteData);
+    checkEncode<freespace::DataModeControlV2Request, 2>(&freespace_message::dataModeControlV2Request);
+    checkEncode<freespace::SensorPeriodRequest, 2>(&freespace_message::sensorPeriodRequest);
+#endif
+
+    printf("%d reports decoded, %d mismatches\n", decoded, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares freespace_util_decodeDceOut, which uses the SIMD kernels where
+ * available, with the generated scalar batch decoder and with one
+ * freespace_decode_message call per report.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.h>
+#include <freespace/freespace_util.h>
+#include <string.h>
+
+#define REPORT_COUNT 4096
+#define ROUNDS 500
+#define REPORT_SIZE 20 // DceOutV4T0
+
+static uint8_t reports[REPORT_COUNT * REPORT_SIZE];
+static uint8_t sampleBase[REPORT_COUNT];
+static int16_t columns[7][REPORT_COUNT];
+static int16_t batchColumns[7][REPORT_COUNT];
+
+static void makeReports(void) {
+    int i;
+
+    benchFill(reports, sizeof(reports), 1);
+    for (i = 0; i < REPORT_COUNT; i++) {
+        uint8_t* r = reports + i * REPORT_SIZE;
+        r[0] = 41;          // DceOutV4 report ID
+        r[1] = REPORT_SIZE;
+        r[4] = 0;           // T0 sub ID
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct freespace_DceOutV4T0Columns c;
+    int16_t* axes[7];
+    double start;
+    int round;
+    int i;
+    int k;
+
+    makeReports();
+    for (k = 0; k < 7; k++) {
+        axes[k] = columns[k];
+    }
+    c.sampleBase = sampleBase;
+    c.ax = batchColumns[0];
+    c.ay = batchColumns[1];
+    c.az = batchColumns[2];
+    c.rx = batchColumns[3];
+    c.ry = batchColumns[4];
+    c.rz = batchColumns[5];
+    c.temperature = batchColumns[6];
+
+    // The paths must agree before their speed means anything.
+    if (freespace_util_decodeDceOut(FREESPACE_MESSAGE_DCEOUTV4T0, reports, REPORT_SIZE, REPORT_COUNT, axes) != FREESPACE_SUCCESS ||
+        freespace_decodeBatchDceOutV4T0(reports, REPORT_SIZE, REPORT_COUNT, 2, &c) != FREESPACE_SUCCESS) {
+        benchFail("decode failed");
+    }
+    if (memcmp(columns, batchColumns, sizeof(columns)) != 0) {
+        benchFail("freespace_util_decodeDceOut vs freespace_decodeBatchDceOutV4T0");
+    }
+
+    printf("DceOutV4T0, %d reports per call\n", REPORT_COUNT);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < REPORT_COUNT; i++) {
+            struct freespace_message m;
+            freespace_decode_message(reports + i * REPORT_SIZE, REPORT_SIZE, &m, 2);
+            columns[0][i] = m.dceOutV4T0.ax;
+            columns[1][i] = m.dceOutV4T0.ay;
+            columns[2][i] = m.dceOutV4T0.az;
+            columns[3][i] = m.dceOutV4T0.rx;
+            columns[4][i] = m.dceOutV4T0.ry;
+            columns[5][i] = m.dceOutV4T0.rz;
+            columns[6][i] = m.dceOutV4T0.temperature;
+        }
+    }
+    benchReport("freespace_decode_message per report", (double) ROUNDS * REPORT_COUNT, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        freespace_decodeBatchDceOutV4T0(reports, REPORT_SIZE, REPORT_COUNT, 2, &c);
+    }
+    benchReport("freespace_decodeBatchDceOutV4T0 (scalar)", (double) ROUNDS * REPORT_COUNT, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        freespace_util_decodeDceOut(FREESPACE_MESSAGE_DCEOUTV4T0, reports, REPORT_SIZE, REPORT_COUNT, axes);
+    }
+    benchReport("freespace_util_decodeDceOut (SIMD)", (double) ROUNDS * REPORT_COUNT, benchSeconds() - start);
+
+    return 0;
+}
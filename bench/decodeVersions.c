@@ -0,0 +1,103 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Times freespace_decode_message() on a mix of HID protocol version 2 reports.
+ * This file is built twice, against codecs generated for every version and
+ * for version 2 only. Both builds must print the same checksum.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.h>
+#include <string.h>
+
+#define REPORT_COUNT 4096
+#define REPORT_SIZE 64
+#define ROUNDS 500
+
+// BodyFrame, UserFrame, MotionEngineOutput and DceOutV4T0
+static const uint8_t reportIds[] = {32, 33, 38, 41};
+static const uint8_t reportSizes[] = {22, 22, 54, 20};
+
+static uint8_t reports[REPORT_COUNT][REPORT_SIZE];
+static int lengths[REPORT_COUNT];
+
+static void makeReports(void) {
+    int i;
+
+    for (i = 0; i < REPORT_COUNT; i++) {
+        int kind = i % sizeof(reportIds);
+        benchFill(reports[i], REPORT_SIZE, i + 1);
+        reports[i][0] = reportIds[kind];
+        reports[i][1] = reportSizes[kind];
+        if (reportIds[kind] == 41) {
+            reports[i][4] = 0; // DceOutV4T0 sub ID
+        }
+        lengths[i] = reportSizes[kind];
+    }
+}
+
+// FNV-1a over the decoded messages. Each message is cleared before it is
+// decoded so padding does not affect the result.
+static unsigned int checksum(void) {
+    struct freespace_message m;
+    unsigned int h = 2166136261u;
+    int i;
+    size_t k;
+
+    for (i = 0; i < REPORT_COUNT; i++) {
+        memset(&m, 0, sizeof(m));
+        if (freespace_decode_message(reports[i], lengths[i], &m, 2) != FREESPACE_SUCCESS) {
+            benchFail("freespace_decode_message rejected a report");
+        }
+        for (k = 0; k < sizeof(m); k++) {
+            h = (h ^ ((const uint8_t*) &m)[k]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+int main(int argc, char* argv[]) {
+    struct freespace_message m;
+    volatile int sink = 0;
+    double start;
+    int round;
+    int i;
+
+    makeReports();
+
+#ifdef FREESPACE_HID_VERSION_ONLY
+    printf("codecs for HID protocol version %d only\n", FREESPACE_HID_VERSION_ONLY);
+#else
+    printf("codecs for every HID protocol version\n");
+#endif
+    printf("checksum %08x\n", checksum());
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < REPORT_COUNT; i++) {
+            sink += freespace_decode_message(reports[i], lengths[i], &m, 2);
+            sink += m.messageType;
+        }
+    }
+    benchReport("freespace_decode_message (reports)", (double) ROUNDS * REPORT_COUNT, benchSeconds() - start);
+
+    return 0;
+}
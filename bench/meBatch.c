@@ -0,0 +1,120 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares freespace_util_convertBatch() with calling the per-packet
+ * freespace_util_get* functions on the same block of format 0 packets.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.h>
+#include <freespace/freespace_util.h>
+#include <string.h>
+
+#define PACKET_COUNT 4096
+#define ROUNDS 500
+#define SECTIONS (FREESPACE_UTIL_ACCELERATION | FREESPACE_UTIL_ANGULAR_VELOCITY | FREESPACE_UTIL_MAGNETOMETER)
+
+static struct freespace_MotionEngineOutput packets[PACKET_COUNT];
+
+// Per-packet results, one column per axis
+static float perPacket[9][PACKET_COUNT];
+// convertBatch results
+static float batch[9][PACKET_COUNT];
+
+static void makePackets(void) {
+    int i;
+
+    for (i = 0; i < PACKET_COUNT; i++) {
+        struct freespace_MotionEngineOutput* p = &packets[i];
+        memset(p, 0, sizeof(*p));
+        p->formatSelect = 0;
+        p->ff1 = 1; // acceleration
+        p->ff3 = 1; // angular velocity
+        p->ff4 = 1; // magnetometer
+        p->sequenceNumber = i;
+        benchFill(p->meData, sizeof(p->meData), i + 1);
+    }
+}
+
+static void convertPerPacket(void) {
+    struct MultiAxisSensor s;
+    int i;
+
+    for (i = 0; i < PACKET_COUNT; i++) {
+        freespace_util_getAcceleration(&packets[i], &s);
+        perPacket[0][i] = s.x;
+        perPacket[1][i] = s.y;
+        perPacket[2][i] = s.z;
+        freespace_util_getAngularVelocity(&packets[i], &s);
+        perPacket[3][i] = s.x;
+        perPacket[4][i] = s.y;
+        perPacket[5][i] = s.z;
+        freespace_util_getMagnetometer(&packets[i], &s);
+        perPacket[6][i] = s.x;
+        perPacket[7][i] = s.y;
+        perPacket[8][i] = s.z;
+    }
+}
+
+static void convertBatch(struct freespace_MEOutputColumns* columns) {
+    if (freespace_util_convertBatch(packets, PACKET_COUNT, SECTIONS, columns) != SECTIONS) {
+        benchFail("freespace_util_convertBatch sections");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct freespace_MEOutputColumns columns;
+    double start;
+    int round;
+    int k;
+
+    makePackets();
+
+    memset(&columns, 0, sizeof(columns));
+    for (k = 0; k < 3; k++) {
+        columns.acceleration[k] = batch[k];
+        columns.angularVelocity[k] = batch[3 + k];
+        columns.magnetometer[k] = batch[6 + k];
+    }
+
+    // Format 0 uses power of two scales, so both paths must agree exactly.
+    convertPerPacket();
+    convertBatch(&columns);
+    if (memcmp(perPacket, batch, sizeof(batch)) != 0) {
+        benchFail("convertBatch vs freespace_util_get*");
+    }
+
+    printf("MEOut format 0, acceleration + angular velocity + magnetometer, %d packets per block\n", PACKET_COUNT);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        convertPerPacket();
+    }
+    benchReport("freespace_util_get* (packets)", (double) ROUNDS * PACKET_COUNT, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        convertBatch(&columns);
+    }
+    benchReport("freespace_util_convertBatch (packets)", (double) ROUNDS * PACKET_COUNT, benchSeconds() - start);
+
+    return 0;
+}
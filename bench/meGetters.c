@@ -0,0 +1,123 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Compares the float MEOut getters with their raw fixed-point variants on
+ * format 0 packets carrying acceleration, angular velocity and magnetometer.
+ */
+
+#include "bench.h"
+#include <freespace/freespace_codecs.h>
+#include <freespace/freespace_util.h>
+#include <math.h>
+#include <string.h>
+
+#define PACKET_COUNT 1024
+#define ROUNDS 2000
+
+static struct freespace_MotionEngineOutput packets[PACKET_COUNT];
+
+static void makePackets(void) {
+    int i;
+
+    for (i = 0; i < PACKET_COUNT; i++) {
+        struct freespace_MotionEngineOutput* p = &packets[i];
+        memset(p, 0, sizeof(*p));
+        p->formatSelect = 0;
+        p->ff1 = 1; // acceleration
+        p->ff2 = 1; // acceleration without gravity
+        p->ff3 = 1; // angular velocity
+        p->ff4 = 1; // magnetometer
+        p->ff5 = 1; // inclination
+        p->ff6 = 1; // compass heading
+        p->sequenceNumber = i;
+        benchFill(p->meData, sizeof(p->meData), i + 1);
+    }
+}
+
+static int nearlyEqual(float a, float b) {
+    return fabs(a - b) <= 1e-6 * (fabs(a) + 1.0);
+}
+
+static void checkRaw(const struct MultiAxisSensor* f, const struct MultiAxisSensorRaw* r) {
+    if (!nearlyEqual(f->x, (float) r->x / r->scale) ||
+        !nearlyEqual(f->y, (float) r->y / r->scale) ||
+        !nearlyEqual(f->z, (float) r->z / r->scale)) {
+        benchFail("float getter vs raw getter / scale");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct MultiAxisSensor f;
+    struct MultiAxisSensorRaw r;
+    volatile float floatSink = 0;
+    volatile int rawSink = 0;
+    double start;
+    int round;
+    int i;
+
+    makePackets();
+
+    // The paths must agree before their speed means anything.
+    for (i = 0; i < PACKET_COUNT; i++) {
+        if (freespace_util_getAcceleration(&packets[i], &f) != 0 || freespace_util_getAccelerationRaw(&packets[i], &r) != 0) {
+            benchFail("acceleration missing");
+        }
+        checkRaw(&f, &r);
+        if (freespace_util_getAngularVelocity(&packets[i], &f) != 0 || freespace_util_getAngularVelocityRaw(&packets[i], &r) != 0) {
+            benchFail("angular velocity missing");
+        }
+        checkRaw(&f, &r);
+        if (freespace_util_getMagnetometer(&packets[i], &f) != 0 || freespace_util_getMagnetometerRaw(&packets[i], &r) != 0) {
+            benchFail("magnetometer missing");
+        }
+        checkRaw(&f, &r);
+    }
+
+    printf("MEOut format 0, acceleration + angular velocity + magnetometer per packet\n");
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < PACKET_COUNT; i++) {
+            freespace_util_getAcceleration(&packets[i], &f);
+            floatSink += f.x;
+            freespace_util_getAngularVelocity(&packets[i], &f);
+            floatSink += f.y;
+            freespace_util_getMagnetometer(&packets[i], &f);
+            floatSink += f.z;
+        }
+    }
+    benchReport("float getters (packets)", (double) ROUNDS * PACKET_COUNT, benchSeconds() - start);
+
+    start = benchSeconds();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < PACKET_COUNT; i++) {
+            freespace_util_getAccelerationRaw(&packets[i], &r);
+            rawSink += r.x;
+            freespace_util_getAngularVelocityRaw(&packets[i], &r);
+            rawSink += r.y;
+            freespace_util_getMagnetometerRaw(&packets[i], &r);
+            rawSink += r.z;
+        }
+    }
+    benchReport("raw getters (packets)", (double) ROUNDS * PACKET_COUNT, benchSeconds() - start);
+
+    return 0;
+}
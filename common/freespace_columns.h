@@ -0,0 +1,37 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FREESPACE_COLUMNS_H_
+#define FREESPACE_COLUMNS_H_
+
+#include "freespace/freespace_common.h"
+
+/*
+ * Decode axisCount consecutive little endian int16 values starting offset
+ * bytes into each of count records, stride bytes apart and recordSize bytes
+ * long, into one column per axis. Nothing past the end of the last record
+ * is read. Uses the SIMD kernels in freespace_dceDecode.c where available.
+ * axes and floatAxes may be NULL, as may any column in them. Float columns
+ * are multiplied by scale[k], or 1 if scale is NULL.
+ */
+void freespace_private_decodeColumns(const uint8_t* reports, int stride, int recordSize, int count,
+                                     int offset, int axisCount, int16_t* const* axes, float* const* floatAxes, const float* scale);
+
+#endif /* FREESPACE_COLUMNS_H_ */
@@ -0,0 +1,429 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <freespace/freespace_util.h>
+#include "freespace_columns.h"
+#include <string.h>
+
+/*
+ * The DceOut reports carry their sensor axes as a run of consecutive
+ * little endian int16 values. The kernels below load eight axes from each
+ * of eight (SSE) or sixteen (AVX2) reports, transpose them in registers and
+ * store one vector per axis column.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FREESPACE_DCE_SIMD
+#define FREESPACE_DCE_TARGET(x) __attribute__((target(x)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define FREESPACE_DCE_SIMD
+#define FREESPACE_DCE_TARGET(x)
+#include <windows.h>
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Where the axes of each DceOut message start, how many there are and the
+// size of the v2 report.
+struct DceLayout {
+    int messageType;
+    int offset;
+    int axisCount;
+    int size;
+};
+
+static const struct DceLayout dceLayouts[] = {
+    {FREESPACE_MESSAGE_DCEOUTV2, 8, 10, 31},   // ax ay az rx ry rz mx my mz temperature
+    {FREESPACE_MESSAGE_DCEOUTV3, 6, 7, 20},    // ax ay az rx ry rz temperature
+    {FREESPACE_MESSAGE_DCEOUTV4T0, 6, 7, 20},  // ax ay az rx ry rz temperature
+    {FREESPACE_MESSAGE_DCEOUTV4T1, 6, 3, 15},  // mx my mz
+};
+
+// The kernels load 16 bytes per report and pass.
+#define DCE_LOAD_SIZE 16
+#define DCE_PASS_AXES 8
+
+// Returns the number of reports decoded, a multiple of its block size. A
+// NULL kernel leaves every report to the scalar loop.
+typedef int (*dceKernel)(const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                         int16_t* const* axes, float* const* floatAxes, const float* scale);
+
+static const struct DceLayout* findLayout(int messageType) {
+    int i;
+    for (i = 0; i < (int) (sizeof(dceLayouts) / sizeof(dceLayouts[0])); i++) {
+        if (dceLayouts[i].messageType == messageType) {
+            return &dceLayouts[i];
+        }
+    }
+    return NULL;
+}
+
+static void decodeScalar(const uint8_t* reports, int stride, int start, int count, int offset, int axisCount,
+                         int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    int i;
+    int k;
+
+    for (k = 0; k < axisCount; k++) {
+        const uint8_t* p = reports + offset + 2 * k;
+        if (axes != NULL && axes[k] != NULL) {
+            for (i = start; i < count; i++) {
+                axes[k][i] = (int16_t) (p[i * stride] | (p[i * stride + 1] << 8));
+            }
+        }
+        if (floatAxes != NULL && floatAxes[k] != NULL) {
+            float s = (scale != NULL) ? scale[k] : 1.0f;
+            for (i = start; i < count; i++) {
+                floatAxes[k][i] = (float) (int16_t) (p[i * stride] | (p[i * stride + 1] << 8)) * s;
+            }
+        }
+    }
+}
+
+#ifdef FREESPACE_DCE_SIMD
+
+FREESPACE_DCE_TARGET("sse4.1")
+static void storeSse(__m128i column, int i, int16_t* axis, float* floatAxis, float s) {
+    if (axis != NULL) {
+        _mm_storeu_si128((__m128i*) (axis + i), column);
+    }
+    if (floatAxis != NULL) {
+        __m128 vs = _mm_set1_ps(s);
+        __m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(column));
+        __m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(column, 8)));
+        _mm_storeu_ps(floatAxis + i, _mm_mul_ps(lo, vs));
+        _mm_storeu_ps(floatAxis + i + 4, _mm_mul_ps(hi, vs));
+    }
+}
+
+// Decode one pass of up to eight axes for reports [0, count) in blocks of 8.
+FREESPACE_DCE_TARGET("sse4.1")
+static void passSse(const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                    int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    int i;
+    int k;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        const uint8_t* p = reports + i * stride + offset;
+        __m128i c[8];
+        __m128i t0, t1, t2, t3, t4, t5, t6, t7;
+        __m128i u0, u1, u2, u3, u4, u5, u6, u7;
+        __m128i r0 = _mm_loadu_si128((const __m128i*) (p + 0 * stride));
+        __m128i r1 = _mm_loadu_si128((const __m128i*) (p + 1 * stride));
+        __m128i r2 = _mm_loadu_si128((const __m128i*) (p + 2 * stride));
+        __m128i r3 = _mm_loadu_si128((const __m128i*) (p + 3 * stride));
+        __m128i r4 = _mm_loadu_si128((const __m128i*) (p + 4 * stride));
+        __m128i r5 = _mm_loadu_si128((const __m128i*) (p + 5 * stride));
+        __m128i r6 = _mm_loadu_si128((const __m128i*) (p + 6 * stride));
+        __m128i r7 = _mm_loadu_si128((const __m128i*) (p + 7 * stride));
+
+        // 8x8 transpose of int16 values: rows are reports, columns are axes.
+        t0 = _mm_unpacklo_epi16(r0, r1);
+        t1 = _mm_unpackhi_epi16(r0, r1);
+        t2 = _mm_unpacklo_epi16(r2, r3);
+        t3 = _mm_unpackhi_epi16(r2, r3);
+        t4 = _mm_unpacklo_epi16(r4, r5);
+        t5 = _mm_unpackhi_epi16(r4, r5);
+        t6 = _mm_unpacklo_epi16(r6, r7);
+        t7 = _mm_unpackhi_epi16(r6, r7);
+        u0 = _mm_unpacklo_epi32(t0, t2);
+        u1 = _mm_unpackhi_epi32(t0, t2);
+        u2 = _mm_unpacklo_epi32(t1, t3);
+        u3 = _mm_unpackhi_epi32(t1, t3);
+        u4 = _mm_unpacklo_epi32(t4, t6);
+        u5 = _mm_unpackhi_epi32(t4, t6);
+        u6 = _mm_unpacklo_epi32(t5, t7);
+        u7 = _mm_unpackhi_epi32(t5, t7);
+        c[0] = _mm_unpacklo_epi64(u0, u4);
+        c[1] = _mm_unpackhi_epi64(u0, u4);
+        c[2] = _mm_unpacklo_epi64(u1, u5);
+        c[3] = _mm_unpackhi_epi64(u1, u5);
+        c[4] = _mm_unpacklo_epi64(u2, u6);
+        c[5] = _mm_unpackhi_epi64(u2, u6);
+        c[6] = _mm_unpacklo_epi64(u3, u7);
+        c[7] = _mm_unpackhi_epi64(u3, u7);
+
+        for (k = 0; k < axisCount; k++) {
+            storeSse(c[k], i,
+                     axes != NULL ? axes[k] : NULL,
+                     floatAxes != NULL ? floatAxes[k] : NULL,
+                     scale != NULL ? scale[k] : 1.0f);
+        }
+    }
+}
+
+FREESPACE_DCE_TARGET("avx2")
+static void storeAvx2(__m256i column, int i, int16_t* axis, float* floatAxis, float s) {
+    if (axis != NULL) {
+        _mm256_storeu_si256((__m256i*) (axis + i), column);
+    }
+    if (floatAxis != NULL) {
+        __m256 vs = _mm256_set1_ps(s);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(column)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(column, 1)));
+        _mm256_storeu_ps(floatAxis + i, _mm256_mul_ps(lo, vs));
+        _mm256_storeu_ps(floatAxis + i + 8, _mm256_mul_ps(hi, vs));
+    }
+}
+
+FREESPACE_DCE_TARGET("avx2")
+static __m256i loadPairAvx2(const uint8_t* lo, const uint8_t* hi) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) lo)),
+                                   _mm_loadu_si128((const __m128i*) hi), 1);
+}
+
+// Decode one pass of up to eight axes for reports [0, count) in blocks of 16.
+// Reports i..i+7 go in the low lanes and i+8..i+15 in the high lanes, so the
+// in-lane unpacks transpose both halves at once.
+FREESPACE_DCE_TARGET("avx2")
+static void passAvx2(const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                     int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    int i;
+    int k;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        const uint8_t* p = reports + i * stride + offset;
+        const uint8_t* q = p + 8 * stride;
+        __m256i c[8];
+        __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+        __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+        __m256i r0 = loadPairAvx2(p + 0 * stride, q + 0 * stride);
+        __m256i r1 = loadPairAvx2(p + 1 * stride, q + 1 * stride);
+        __m256i r2 = loadPairAvx2(p + 2 * stride, q + 2 * stride);
+        __m256i r3 = loadPairAvx2(p + 3 * stride, q + 3 * stride);
+        __m256i r4 = loadPairAvx2(p + 4 * stride, q + 4 * stride);
+        __m256i r5 = loadPairAvx2(p + 5 * stride, q + 5 * stride);
+        __m256i r6 = loadPairAvx2(p + 6 * stride, q + 6 * stride);
+        __m256i r7 = loadPairAvx2(p + 7 * stride, q + 7 * stride);
+
+        t0 = _mm256_unpacklo_epi16(r0, r1);
+        t1 = _mm256_unpackhi_epi16(r0, r1);
+        t2 = _mm256_unpacklo_epi16(r2, r3);
+        t3 = _mm256_unpackhi_epi16(r2, r3);
+        t4 = _mm256_unpacklo_epi16(r4, r5);
+        t5 = _mm256_unpackhi_epi16(r4, r5);
+        t6 = _mm256_unpacklo_epi16(r6, r7);
+        t7 = _mm256_unpackhi_epi16(r6, r7);
+        u0 = _mm256_unpacklo_epi32(t0, t2);
+        u1 = _mm256_unpackhi_epi32(t0, t2);
+        u2 = _mm256_unpacklo_epi32(t1, t3);
+        u3 = _mm256_unpackhi_epi32(t1, t3);
+        u4 = _mm256_unpacklo_epi32(t4, t6);
+        u5 = _mm256_unpackhi_epi32(t4, t6);
+        u6 = _mm256_unpacklo_epi32(t5, t7);
+        u7 = _mm256_unpackhi_epi32(t5, t7);
+        c[0] = _mm256_unpacklo_epi64(u0, u4);
+        c[1] = _mm256_unpackhi_epi64(u0, u4);
+        c[2] = _mm256_unpacklo_epi64(u1, u5);
+        c[3] = _mm256_unpackhi_epi64(u1, u5);
+        c[4] = _mm256_unpacklo_epi64(u2, u6);
+        c[5] = _mm256_unpackhi_epi64(u2, u6);
+        c[6] = _mm256_unpacklo_epi64(u3, u7);
+        c[7] = _mm256_unpackhi_epi64(u3, u7);
+
+        for (k = 0; k < axisCount; k++) {
+            storeAvx2(c[k], i,
+                      axes != NULL ? axes[k] : NULL,
+                      floatAxes != NULL ? floatAxes[k] : NULL,
+                      scale != NULL ? scale[k] : 1.0f);
+        }
+    }
+}
+
+// Run a pass over the first eight axes and, for layouts with more, a second
+// pass over the last eight. The passes overlap rather than reading past the
+// end of the axes. Returns the number of reports decoded.
+static int runPasses(void (*pass)(const uint8_t*, int, int, int, int, int16_t* const*, float* const*, const float*),
+                     int block, const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                     int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    int n = count - count % block;
+    int first = axisCount < DCE_PASS_AXES ? axisCount : DCE_PASS_AXES;
+
+    pass(reports, stride, n, offset, first, axes, floatAxes, scale);
+    if (axisCount > DCE_PASS_AXES) {
+        int skip = axisCount - DCE_PASS_AXES;
+        pass(reports, stride, n, offset + 2 * skip, DCE_PASS_AXES,
+             axes != NULL ? axes + skip : NULL,
+             floatAxes != NULL ? floatAxes + skip : NULL,
+             scale != NULL ? scale + skip : NULL);
+    }
+    return n;
+}
+
+static int sseKernel(const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                     int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    return runPasses(passSse, 8, reports, stride, count, offset, axisCount, axes, floatAxes, scale);
+}
+
+static int avx2Kernel(const uint8_t* reports, int stride, int count, int offset, int axisCount,
+                      int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    return runPasses(passAvx2, 16, reports, stride, count, offset, axisCount, axes, floatAxes, scale);
+}
+
+static dceKernel detectKernel(void) {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2Kernel;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return sseKernel;
+    }
+#else
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6) {
+        // OSXSAVE and AVX, with the OS saving YMM state
+        int info7[4];
+        __cpuidex(info7, 7, 0);
+        if (info7[1] & (1 << 5)) {
+            return avx2Kernel;
+        }
+    }
+    if (info[2] & (1 << 19)) {
+        return sseKernel;
+    }
+#endif
+    return NULL;
+}
+
+static dceKernel activeKernel = NULL;
+
+#if defined(__GNUC__)
+// Pick the kernel once when the library is loaded, before any caller can
+// be decoding on another thread.
+__attribute__((constructor))
+static void selectKernel(void) {
+    activeKernel = detectKernel();
+}
+
+static dceKernel getKernel(void) {
+    return activeKernel;
+}
+#else
+static INIT_ONCE kernelOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK selectKernel(PINIT_ONCE once, PVOID param, PVOID* context) {
+    activeKernel = detectKernel();
+    return TRUE;
+}
+
+static dceKernel getKernel(void) {
+    InitOnceExecuteOnce(&kernelOnce, selectKernel, NULL, NULL);
+    return activeKernel;
+}
+#endif
+
+#else
+
+static dceKernel getKernel(void) {
+    return NULL;
+}
+
+#endif
+
+void freespace_private_decodeColumns(const uint8_t* reports, int stride, int recordSize, int count,
+                                     int offset, int axisCount, int16_t* const* axes,
+                                     float* const* floatAxes, const float* scale) {
+    dceKernel kernel = getKernel();
+    int loadEnd;
+    int simdCount;
+    int n = 0;
+
+    if (kernel != NULL && count > 0) {
+        // The kernels read DCE_LOAD_SIZE bytes from the start of the axes,
+        // which can run past the end of the last few records. Leave those
+        // to the scalar loop.
+        loadEnd = offset + DCE_LOAD_SIZE;
+        if (axisCount > DCE_PASS_AXES) {
+            loadEnd += 2 * (axisCount - DCE_PASS_AXES);
+        }
+        simdCount = count;
+        while (simdCount > 0 && (simdCount - 1) * stride + loadEnd > (count - 1) * stride + recordSize) {
+            simdCount--;
+        }
+        n = kernel(reports, stride, simdCount, offset, axisCount, axes, floatAxes, scale);
+    }
+    decodeScalar(reports, stride, n, count, offset, axisCount, axes, floatAxes, scale);
+}
+
+static int decodeDceOut(int messageType, const uint8_t* reports, int stride, int count,
+                        int16_t* const* axes, float* const* floatAxes, const float* scale) {
+    const struct DceLayout* layout;
+    void* columns;
+    int rc;
+    union {
+        struct freespace_DceOutV2Columns v2;
+        struct freespace_DceOutV3Columns v3;
+        struct freespace_DceOutV4T0Columns v4t0;
+        struct freespace_DceOutV4T1Columns v4t1;
+    } noColumns;
+
+    layout = findLayout(messageType);
+    if (layout == NULL) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+
+    // Check the report IDs and the stride without decoding any fields.
+    memset(&noColumns, 0, sizeof(noColumns));
+    columns = &noColumns;
+    rc = freespace_decode_batch(messageType, reports, stride, count, 2, columns);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    freespace_private_decodeColumns(reports, stride, layout->size, count, layout->offset, layout->axisCount,
+                                    axes, floatAxes, scale);
+    return FREESPACE_SUCCESS;
+}
+
+/******************************************************************************
+ * freespace_util_getDceOutAxisCount
+ */
+LIBFREESPACE_API int freespace_util_getDceOutAxisCount(int messageType) {
+    const struct DceLayout* layout = findLayout(messageType);
+    if (layout == NULL) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    return layout->axisCount;
+}
+
+/******************************************************************************
+ * freespace_util_decodeDceOut
+ */
+LIBFREESPACE_API int freespace_util_decodeDceOut(int messageType,
+                                                 const uint8_t* reports,
+                                                 int stride,
+                                                 int count,
+                                                 int16_t* const* axes) {
+    return decodeDceOut(messageType, reports, stride, count, axes, NULL, NULL);
+}
+
+/******************************************************************************
+ * freespace_util_decodeDceOutFloat
+ */
+LIBFREESPACE_API int freespace_util_decodeDceOutFloat(int messageType,
+                                                      const uint8_t* reports,
+                                                      int stride,
+                                                      int count,
+                                                      const float* scale,
+                                                      float* const* axes) {
+    return decodeDceOut(messageType, reports, stride, count, NULL, axes, scale);
+}
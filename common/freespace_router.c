@@ -0,0 +1,383 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "freespace_router.h"
+#include <string.h>
+
+// Nonzero if a callback with this filter wants messages of messageType.
+static int wantsMessage(int filtered, const struct FreespaceMessageMask* mask, int messageType) {
+    return !filtered || FREESPACE_MESSAGE_MASK_HAS(mask, messageType);
+}
+
+static int isSubscribed(const struct FreespaceSubscriber* subscriber) {
+    return subscriber->callback_ != NULL || subscriber->queueDepth_ > 0;
+}
+
+// The shared message holding message, or NULL if it isn't one.
+static struct FreespaceSharedMessage* findShared(struct FreespaceMessageRouter* router,
+                                                 const struct freespace_message* message) {
+    int i;
+
+    for (i = 0; i < FREESPACE_SHARED_MESSAGES_MAX; i++) {
+        if (&router->messages_[i].message_ == message) {
+            return &router->messages_[i];
+        }
+    }
+    return NULL;
+}
+
+// A free shared message with one reference, or NULL if all are held.
+static struct FreespaceSharedMessage* allocShared(struct FreespaceMessageRouter* router) {
+    int i;
+
+    for (i = 0; i < FREESPACE_SHARED_MESSAGES_MAX; i++) {
+        if (router->messages_[i].refs_ == 0) {
+            router->messages_[i].refs_ = 1;
+            return &router->messages_[i];
+        }
+    }
+    return NULL;
+}
+
+// Add shared to the queue of subscriber, dropping the oldest message if it is full.
+static void enqueue(struct FreespaceSubscriber* subscriber, struct FreespaceSharedMessage* shared) {
+    if (subscriber->queueCount_ == subscriber->queueDepth_) {
+        subscriber->queue_[subscriber->queueHead_]->refs_--;
+        subscriber->queueHead_ = (subscriber->queueHead_ + 1) % subscriber->queueDepth_;
+        subscriber->queueCount_--;
+        subscriber->dropped_++;
+    }
+    shared->refs_++;
+    subscriber->queue_[(subscriber->queueHead_ + subscriber->queueCount_) % subscriber->queueDepth_] = shared;
+    subscriber->queueCount_++;
+}
+
+// Claim a free subscriber slot. Returns its index or FREESPACE_ERROR_BUSY.
+static int addSubscriber(struct FreespaceMessageRouter* router,
+                         const struct FreespaceMessageMask* mask) {
+    struct FreespaceSubscriber* subscriber;
+    int i;
+
+    for (i = 0; i < FREESPACE_SUBSCRIBERS_MAX; i++) {
+        subscriber = &router->subscribers_[i];
+        if (!isSubscribed(subscriber)) {
+            memset(subscriber, 0, sizeof(*subscriber));
+            if (mask != NULL) {
+                subscriber->filtered_ = 1;
+                subscriber->mask_ = *mask;
+            }
+            router->subscriberCount_++;
+            return i;
+        }
+    }
+    return FREESPACE_ERROR_BUSY;
+}
+
+void freespace_private_setMessageFilter(struct FreespaceMessageRouter* router,
+                                        const struct FreespaceMessageMask* mask) {
+    if (mask == NULL) {
+        router->filtered_ = 0;
+        memset(&router->mask_, 0, sizeof(router->mask_));
+    } else {
+        router->filtered_ = 1;
+        router->mask_ = *mask;
+    }
+}
+
+int freespace_private_setMessageTypeCallback(struct FreespaceMessageRouter* router,
+                                             int messageType,
+                                             freespace_receiveMessageCallback callback,
+                                             void* cookie) {
+    if (messageType < 0 || messageType >= FREESPACE_MESSAGE_TYPE_COUNT) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    if (router->typeCallbacks_[messageType] == NULL && callback != NULL) {
+        router->typeCallbackCount_++;
+    } else if (router->typeCallbacks_[messageType] != NULL && callback == NULL) {
+        router->typeCallbackCount_--;
+    }
+    router->typeCallbacks_[messageType] = callback;
+    router->typeCookies_[messageType] = callback != NULL ? cookie : NULL;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_subscribe(struct FreespaceMessageRouter* router,
+                                const struct FreespaceMessageMask* mask,
+                                freespace_subscriberCallback callback,
+                                void* cookie) {
+    int i;
+
+    if (callback == NULL) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    i = addSubscriber(router, mask);
+    if (i >= 0) {
+        router->subscribers_[i].callback_ = callback;
+        router->subscribers_[i].cookie_ = cookie;
+    }
+    return i;
+}
+
+int freespace_private_subscribeQueue(struct FreespaceMessageRouter* router,
+                                     const struct FreespaceMessageMask* mask,
+                                     int depth) {
+    int i;
+
+    if (depth <= 0 || depth > FREESPACE_SUBSCRIBER_QUEUE_MAX) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    i = addSubscriber(router, mask);
+    if (i >= 0) {
+        router->subscribers_[i].queueDepth_ = depth;
+    }
+    return i;
+}
+
+int freespace_private_unsubscribe(struct FreespaceMessageRouter* router,
+                                  int subscription) {
+    struct FreespaceSubscriber* subscriber;
+    int i;
+
+    if (subscription < 0 || subscription >= FREESPACE_SUBSCRIBERS_MAX ||
+        !isSubscribed(&router->subscribers_[subscription])) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    subscriber = &router->subscribers_[subscription];
+    for (i = 0; i < subscriber->queueCount_; i++) {
+        subscriber->queue_[(subscriber->queueHead_ + i) % subscriber->queueDepth_]->refs_--;
+    }
+    memset(subscriber, 0, sizeof(*subscriber));
+    router->subscriberCount_--;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_popMessage(struct FreespaceMessageRouter* router,
+                                 int subscription,
+                                 const struct freespace_message** message) {
+    struct FreespaceSubscriber* subscriber;
+
+    if (subscription < 0 || subscription >= FREESPACE_SUBSCRIBERS_MAX ||
+        !isSubscribed(&router->subscribers_[subscription])) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+    subscriber = &router->subscribers_[subscription];
+    if (subscriber->queueDepth_ == 0 || message == NULL) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+    if (subscriber->queueCount_ == 0) {
+        return FREESPACE_ERROR_NO_DATA;
+    }
+
+    // The queue's reference passes to the caller.
+    *message = &subscriber->queue_[subscriber->queueHead_]->message_;
+    subscriber->queueHead_ = (subscriber->queueHead_ + 1) % subscriber->queueDepth_;
+    subscriber->queueCount_--;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_getDroppedMessages(struct FreespaceMessageRouter* router,
+                                         int subscription,
+                                         uint32_t* dropped) {
+    struct FreespaceSubscriber* subscriber;
+
+    if (subscription < 0 || subscription >= FREESPACE_SUBSCRIBERS_MAX ||
+        !isSubscribed(&router->subscribers_[subscription])) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+    subscriber = &router->subscribers_[subscription];
+    if (subscriber->queueDepth_ == 0 || dropped == NULL) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+    *dropped = subscriber->dropped_;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_drainMessages(struct FreespaceMessageRouter* router,
+                                    FreespaceDeviceId id,
+                                    int subscription,
+                                    freespace_subscriberCallback callback,
+                                    void* cookie) {
+    const struct freespace_message* message;
+    int count = 0;
+    int rc;
+
+    if (callback == NULL) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    // Pop one at a time, since the callback may unsubscribe.
+    while ((rc = freespace_private_popMessage(router, subscription, &message)) == FREESPACE_SUCCESS) {
+        callback(id, message, cookie, FREESPACE_SUCCESS);
+        freespace_private_releaseMessage(router, message);
+        count++;
+    }
+    if (rc != FREESPACE_ERROR_NO_DATA && count == 0) {
+        return rc;
+    }
+    return count;
+}
+
+int freespace_private_acquireMessage(struct FreespaceMessageRouter* router,
+                                     const struct freespace_message* message) {
+    struct FreespaceSharedMessage* shared = findShared(router, message);
+
+    if (shared == NULL || shared->refs_ == 0) {
+        if (message != NULL && message == router->unshared_) {
+            return FREESPACE_ERROR_BUSY;
+        }
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+    shared->refs_++;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_releaseMessage(struct FreespaceMessageRouter* router,
+                                     const struct freespace_message* message) {
+    struct FreespaceSharedMessage* shared = findShared(router, message);
+
+    if (shared == NULL || shared->refs_ == 0) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+    shared->refs_--;
+    return FREESPACE_SUCCESS;
+}
+
+void freespace_private_routeMessage(struct FreespaceMessageRouter* router,
+                                    FreespaceDeviceId id,
+                                    const uint8_t* report,
+                                    int length,
+                                    uint8_t ver,
+                                    freespace_receiveMessageCallback callback,
+                                    void* cookie) {
+    struct freespace_message m;
+    struct freespace_message unshared;
+    struct freespace_message* result;
+    struct FreespaceSharedMessage* shared;
+    struct FreespaceSubscriber* subscriber;
+    const struct freespace_message* previousUnshared;
+    freespace_receiveMessageCallback typeCallback;
+    int subscribersWanting;
+    int messageType;
+    int rc;
+    int i;
+
+    if (!router->filtered_ && router->typeCallbackCount_ == 0 && router->subscriberCount_ == 0) {
+        // Nothing to route on, so decode everything for callback.
+        if (callback != NULL) {
+            rc = freespace_decode_message(report, length, &m, ver);
+            callback(id, rc == FREESPACE_SUCCESS ? &m : NULL, cookie, rc);
+        }
+        return;
+    }
+
+    messageType = freespace_peekMessageType(report, length, ver);
+    if (messageType < 0) {
+        // Unknown reports can't match a filter, so only report them unfiltered.
+        // Queues only hold decoded messages.
+        if (callback != NULL && !router->filtered_) {
+            callback(id, NULL, cookie, messageType);
+        }
+        for (i = 0; i < FREESPACE_SUBSCRIBERS_MAX; i++) {
+            subscriber = &router->subscribers_[i];
+            if (subscriber->callback_ != NULL && !subscriber->filtered_) {
+                subscriber->callback_(id, NULL, subscriber->cookie_, messageType);
+            }
+        }
+        return;
+    }
+
+    typeCallback = router->typeCallbacks_[messageType];
+    if (callback != NULL && !wantsMessage(router->filtered_, &router->mask_, messageType)) {
+        callback = NULL;
+    }
+    subscribersWanting = 0;
+    for (i = 0; i < FREESPACE_SUBSCRIBERS_MAX; i++) {
+        subscriber = &router->subscribers_[i];
+        if (isSubscribed(subscriber) && wantsMessage(subscriber->filtered_, &subscriber->mask_, messageType)) {
+            subscribersWanting++;
+        }
+    }
+
+    if (subscribersWanting == 0) {
+        if (callback != NULL || typeCallback != NULL) {
+            rc = freespace_decode_message(report, length, &m, ver);
+            result = rc == FREESPACE_SUCCESS ? &m : NULL;
+            if (typeCallback != NULL) {
+                typeCallback(id, result, router->typeCookies_[messageType], rc);
+            }
+            if (callback != NULL) {
+                callback(id, result, cookie, rc);
+            }
+        }
+        return;
+    }
+
+    // Decode once into a shared message, which the router holds while routing.
+    // If every shared message is held, subscribers get one that can't be kept.
+    shared = allocShared(router);
+    result = shared != NULL ? &shared->message_ : &unshared;
+    rc = freespace_decode_message(report, length, result, ver);
+    if (rc != FREESPACE_SUCCESS) {
+        result = NULL;
+    }
+    previousUnshared = router->unshared_;
+    if (shared == NULL) {
+        router->unshared_ = &unshared;
+    }
+
+    // The type and receive message callbacks may modify the message, so
+    // they get a copy.
+    if (typeCallback != NULL || callback != NULL) {
+        if (result != NULL) {
+            m = *result;
+        }
+        if (typeCallback != NULL) {
+            typeCallback(id, result != NULL ? &m : NULL, router->typeCookies_[messageType], rc);
+        }
+        if (callback != NULL) {
+            callback(id, result != NULL ? &m : NULL, cookie, rc);
+        }
+    }
+    for (i = 0; i < FREESPACE_SUBSCRIBERS_MAX; i++) {
+        // Callbacks may subscribe or unsubscribe, so check each slot as it is reached.
+        subscriber = &router->subscribers_[i];
+        if (!isSubscribed(subscriber) || !wantsMessage(subscriber->filtered_, &subscriber->mask_, messageType)) {
+            continue;
+        }
+        if (subscriber->callback_ != NULL) {
+            subscriber->callback_(id, result, subscriber->cookie_, rc);
+        } else if (result != NULL) {
+            if (shared != NULL) {
+                enqueue(subscriber, shared);
+            } else {
+                subscriber->dropped_++;
+            }
+        }
+    }
+
+    router->unshared_ = previousUnshared;
+    if (shared != NULL) {
+        shared->refs_--;
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FREESPACE_ROUTER_H_
+#define FREESPACE_ROUTER_H_
+
+#include "freespace/freespace.h"
+
+/*
+ * A decoded message shared by the subscribers of a device. refs_ counts
+ * the router while it routes the message, every freespace_acquireMessage()
+ * and every queue holding it. The slot is free when it is 0.
+ */
+struct FreespaceSharedMessage {
+    struct freespace_message message_;
+    int refs_;
+};
+
+/*
+ * A subscriber added with freespace_subscribe(), which has a callback_, or
+ * with freespace_subscribeQueue(), which has a queueDepth_. A free slot has
+ * neither.
+ */
+struct FreespaceSubscriber {
+    freespace_subscriberCallback callback_;
+    void* cookie_;
+    int filtered_;
+    struct FreespaceMessageMask mask_;
+    int queueDepth_;
+    int queueHead_;
+    int queueCount_;
+    uint32_t dropped_;
+    struct FreespaceSharedMessage* queue_[FREESPACE_SUBSCRIBER_QUEUE_MAX];
+};
+
+/*
+ * The message filter, per-type callbacks and subscribers of one device. The backends
+ * pass every received report through freespace_private_routeMessage,
+ * which only decodes reports that some callback wants. A zeroed router
+ * passes everything to the receive message callback.
+ */
+struct FreespaceMessageRouter {
+    int filtered_;
+    struct FreespaceMessageMask mask_;
+    freespace_receiveMessageCallback typeCallbacks_[FREESPACE_MESSAGE_TYPE_COUNT];
+    void* typeCookies_[FREESPACE_MESSAGE_TYPE_COUNT];
+    int typeCallbackCount_;
+    struct FreespaceSubscriber subscribers_[FREESPACE_SUBSCRIBERS_MAX];
+    int subscriberCount_;
+    struct FreespaceSharedMessage messages_[FREESPACE_SHARED_MESSAGES_MAX];
+    // The message being routed when every shared message was held.
+    const struct freespace_message* unshared_;
+};
+
+void freespace_private_setMessageFilter(struct FreespaceMessageRouter* router,
+                                        const struct FreespaceMessageMask* mask);
+
+int freespace_private_setMessageTypeCallback(struct FreespaceMessageRouter* router,
+                                             int messageType,
+                                             freespace_receiveMessageCallback callback,
+                                             void* cookie);
+
+/*
+ * Add a subscriber. Returns its slot, or FREESPACE_ERROR_BUSY if all
+ * FREESPACE_SUBSCRIBERS_MAX slots are in use.
+ */
+int freespace_private_subscribe(struct FreespaceMessageRouter* router,
+                                const struct FreespaceMessageMask* mask,
+                                freespace_subscriberCallback callback,
+                                void* cookie);
+
+/*
+ * Add a subscriber that queues up to depth messages. Returns its slot or
+ * an error like freespace_private_subscribe().
+ */
+int freespace_private_subscribeQueue(struct FreespaceMessageRouter* router,
+                                     const struct FreespaceMessageMask* mask,
+                                     int depth);
+
+int freespace_private_unsubscribe(struct FreespaceMessageRouter* router,
+                                  int subscription);
+
+int freespace_private_popMessage(struct FreespaceMessageRouter* router,
+                                 int subscription,
+                                 const struct freespace_message** message);
+
+int freespace_private_getDroppedMessages(struct FreespaceMessageRouter* router,
+                                         int subscription,
+                                         uint32_t* dropped);
+
+int freespace_private_drainMessages(struct FreespaceMessageRouter* router,
+                                    FreespaceDeviceId id,
+                                    int subscription,
+                                    freespace_subscriberCallback callback,
+                                    void* cookie);
+
+int freespace_private_acquireMessage(struct FreespaceMessageRouter* router,
+                                     const struct freespace_message* message);
+
+int freespace_private_releaseMessage(struct FreespaceMessageRouter* router,
+                                     const struct freespace_message* message);
+
+/*
+ * Decode a received report and pass it to the callback for its type, to
+ * callback, the device's receive message callback, and to the
+ * subscribers that want it. The report is decoded at most once. The
+ * subscribers share one message; the other callbacks get a copy when
+ * there are subscribers, since they may modify it. callback may be NULL.
+ */
+void freespace_private_routeMessage(struct FreespaceMessageRouter* router,
+                                    FreespaceDeviceId id,
+                                    const uint8_t* report,
+                                    int length,
+                                    uint8_t ver,
+                                    freespace_receiveMessageCallback callback,
+                                    void* cookie);
+
+#endif /* FREESPACE_ROUTER_H_ */
@@ -18,57 +18,146 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+
 #include <freespace/freespace_util.h>
+#include "freespace_meLayout.h"
+#include "freespace_columns.h"
+#include <stddef.h>
+#include <string.h>
+
+// Pack ff0..ff7 into the index used by meLayouts
+static int meOutFlags(struct freespace_MotionEngineOutput const * meOutPkt) {
+    return (meOutPkt->ff0 == 1) << 0 |
+           (meOutPkt->ff1 == 1) << 1 |
+           (meOutPkt->ff2 == 1) << 2 |
+           (meOutPkt->ff3 == 1) << 3 |
+           (meOutPkt->ff4 == 1) << 4 |
+           (meOutPkt->ff5 == 1) << 5 |
+           (meOutPkt->ff6 == 1) << 6 |
+           (meOutPkt->ff7 == 1) << 7;
+}
 
-/******************************************************************************
- * freespace_util_getAcceleration
- */
-LIBFREESPACE_API int freespace_util_getAcceleration(struct freespace_MotionEngineOutput const * meOutPkt,
-                                                    struct MultiAxisSensor * sensor) {
+// Find a section of a MEOut packet in the layout table.
+// Returns 0 and sets data and recip if the section is present,
+// otherwise the -1, -2 or -3 codes documented for the getters.
+static int meOutSection(struct freespace_MotionEngineOutput const * meOutPkt,
+                        int section,
+                        uint8_t const ** data,
+                        double * recip) {
+    int offset;
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
+    if (meOutPkt->formatSelect >= 4) {
+        return -3; // The format number was unrecognized
+    }
+    if ((meFormatSections[meOutPkt->formatSelect] & (1 << section)) == 0) {
+        return -2; // This format does not contain the section
+    }
+    offset = meLayouts[meOutPkt->formatSelect][meOutFlags(meOutPkt)].offset[section];
+    if (offset < 0) {
+        return -1; // The section's flag is not set
+    }
 
-    switch(meOutPkt->formatSelect) {
-    case 0:
-        scale = 1024.0; // Q10
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        if (meOutPkt->ff1 == 0) {
-            offset = -1; // Acceleration flag not set
-        }
+    *data = &meOutPkt->meData[offset];
+    *recip = meScaleRecip[meOutPkt->formatSelect][section];
+    return 0;
+}
+
+static float meOutAxis(uint8_t const * data, double recip) {
+    int16_t axisVal = data[1] << 8 | data[0];
+    return (float) (axisVal * recip);
+}
+
+static void meOutXYZ(uint8_t const * data, double recip, struct MultiAxisSensor * sensor) {
+    sensor->x = meOutAxis(&data[0], recip);
+    sensor->y = meOutAxis(&data[2], recip);
+    sensor->z = meOutAxis(&data[4], recip);
+}
+
+static void meOutAngPos(struct freespace_MotionEngineOutput const * meOutPkt,
+                        uint8_t const * data, double recip, struct MultiAxisSensor * sensor) {
+    // Format 1 sends the quaternion as X, Y, Z, W; the others as W, X, Y, Z
+    if (meOutPkt->formatSelect == 1) {
+        meOutXYZ(&data[0], recip, sensor);
+        sensor->w = meOutAxis(&data[6], recip);
+    } else {
+        sensor->w = meOutAxis(&data[0], recip);
+        meOutXYZ(&data[2], recip, sensor);
+    }
+}
+
+static void meOutActClass(uint8_t const * data, struct MultiAxisSensor * sensor) {
+    sensor->x = (float) (int8_t) data[0]; // Act Class Flags
+    sensor->y = (float) (int8_t) data[1]; // Power Mgmt Flags
+}
+
+static int16_t meOutRaw(uint8_t const * data) {
+    return data[1] << 8 | data[0];
+}
+
+// Extract a section without converting it to float
+static int meOutRawSection(struct freespace_MotionEngineOutput const * meOutPkt,
+                           int section,
+                           struct MultiAxisSensorRaw * sensor) {
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, section, &data, &recip);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    sensor->scale = meScale[meOutPkt->formatSelect][section];
+    sensor->qFormat = meQFormat[meOutPkt->formatSelect][section];
+
+    switch (section) {
+    case ME_SECTION_TEMPERATURE:
+        sensor->w = meOutRaw(&data[0]);
         break;
-    case 1:
-        scale = 100.0; // 0.01g
-        if (meOutPkt->ff0 == 0) {
-            offset = -1; // Acceleration flag not set
-        }
+    case ME_SECTION_COMPASS_HEADING:
+        sensor->x = meOutRaw(&data[0]);
         break;
-    case 2: 
-        return -2; // No calibrated acceleration in this format
-    case 3:
-        scale = 256.0; // Q8
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        if (meOutPkt->ff1 == 0) {
-            offset = -1; // Acceleration flag not set
+    case ME_SECTION_ANG_POS:
+        // Format 1 sends the quaternion as X, Y, Z, W; the others as W, X, Y, Z
+        if (meOutPkt->formatSelect == 1) {
+            sensor->x = meOutRaw(&data[0]);
+            sensor->y = meOutRaw(&data[2]);
+            sensor->z = meOutRaw(&data[4]);
+            sensor->w = meOutRaw(&data[6]);
+        } else {
+            sensor->w = meOutRaw(&data[0]);
+            sensor->x = meOutRaw(&data[2]);
+            sensor->y = meOutRaw(&data[4]);
+            sensor->z = meOutRaw(&data[6]);
         }
         break;
+    case ME_SECTION_ACT_CLASS:
+        sensor->x = (int8_t) data[0]; // Act Class Flags
+        sensor->y = (int8_t) data[1]; // Power Mgmt Flags
+        break;
     default:
-        return -3; // The format number was unrecognized
+        sensor->x = meOutRaw(&data[0]);
+        sensor->y = meOutRaw(&data[2]);
+        sensor->z = meOutRaw(&data[4]);
+        break;
     }
+    return 0;
+}
 
-    if (offset < 0) {
-        return -1; // Acceleration flag not set
-    }
+/******************************************************************************
+ * freespace_util_getAcceleration
+ */
+LIBFREESPACE_API int freespace_util_getAcceleration(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                    struct MultiAxisSensor * sensor) {
 
-    // Extract and convert the acceleration data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-    sensor->y = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-    sensor->z = ((float) axisVal) / scale;
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_ACCELERATION, &data, &recip);
 
+    if (rc != 0) {
+        return rc;
+    }
+
+    meOutXYZ(data, recip, sensor);
     return 0;
 }
 
@@ -78,52 +167,15 @@ LIBFREESPACE_API int freespace_util_getAcceleration(struct freespace_MotionEngin
 LIBFREESPACE_API int freespace_util_getAccNoGravity(struct freespace_MotionEngineOutput const * meOutPkt,
                                                     struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 0:
-        scale = 1024.0; // Q10
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        if (meOutPkt->ff2 == 0) {
-            offset = -1; // Acceleration No Grav flag not set
-        }
-        break;
-    case 1:
-        scale = 100.0; // 0.01g
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        if (meOutPkt->ff1 == 0) {
-            offset = -1; // Acceleration No Grav flag not set
-        }
-        break;
-    case 2: 
-        return -2; // No calibrated acceleration no gravity in this format
-    case 3:
-        scale = 256.0; // Q8
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        if (meOutPkt->ff2 == 0) {
-            offset = -1; // Acceleration No Grav flag not set
-        }
-        break;
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_ACC_NO_GRAVITY, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Acceleration No Grav flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the acceleration data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-    sensor->y = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-    sensor->z = ((float) axisVal) / scale;
-
+    meOutXYZ(data, recip, sensor);
     return 0;
 }
 
@@ -133,55 +185,15 @@ LIBFREESPACE_API int freespace_util_getAccNoGravity(struct freespace_MotionEngin
 LIBFREESPACE_API int freespace_util_getAngularVelocity(struct freespace_MotionEngineOutput const * meOutPkt,
                                                        struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 0:
-        scale = 1024.0; // Q10
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        if (meOutPkt->ff3 == 0) {
-            offset = -1; // Ang Vel flag not set
-        }
-        break;
-    case 1:
-        scale = 100.0; // 0.1 deg/s
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        if (meOutPkt->ff2 == 0) {
-            offset = -1; // Ang Vel flag not set
-        }
-        break;
-    case 2: 
-        return -2; // No calibrated angular velocity in this format
-    case 3:
-        scale = 512.0; // Q9
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        if (meOutPkt->ff3 == 0) {
-            offset = -1; // Ang Vel flag not set
-        }
-        break;
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_ANGULAR_VELOCITY, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Ang Vel flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the angular velocity data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-    sensor->y = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-    sensor->z = ((float) axisVal) / scale;
-
+    meOutXYZ(data, recip, sensor);
     return 0;
 }
 
@@ -191,58 +203,15 @@ LIBFREESPACE_API int freespace_util_getAngularVelocity(struct freespace_MotionEn
 LIBFREESPACE_API int freespace_util_getMagnetometer(struct freespace_MotionEngineOutput const * meOutPkt,
                                                     struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 0:
-        scale = 4096.0; // Q12
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over ang vel
-        if (meOutPkt->ff4 == 0) {
-            offset = -1; // Mag flag not set
-        }
-        break;
-    case 1:
-        scale = 1000.0; // 0.001 gauss
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over ang vel
-        if (meOutPkt->ff3 == 0) {
-            offset = -1; // Mag flag not set
-        }
-        break;
-    case 2: 
-        return -2; // No calibrated magnetometer in this format
-    case 3:
-        scale = 32.0; // Q5
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over ang vel
-        if (meOutPkt->ff4 == 0) {
-            offset = -1; // Mag flag not set
-        }
-        break;
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_MAGNETOMETER, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Mag flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the magnetometer data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-    sensor->y = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-    sensor->z = ((float) axisVal) / scale;
-
+    meOutXYZ(data, recip, sensor);
     return 0;
 }
 
@@ -252,48 +221,15 @@ LIBFREESPACE_API int freespace_util_getMagnetometer(struct freespace_MotionEngin
 LIBFREESPACE_API int freespace_util_getTemperature(struct freespace_MotionEngineOutput const * meOutPkt,
                                                    struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 0:
-        scale = 128.0; // Q7
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over mag
-        if (meOutPkt->ff5 == 0) {
-            offset = -1; // Temperature flag not set
-        }
-        break;
-    case 1:
-    case 2: 
-        return -2; // No calibrated temperature in this format
-    case 3:
-        scale = 128.0; // Q7
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over mag
-        if (meOutPkt->ff5 == 0) {
-            offset = -1; // Mag flag not set
-        }
-        break;
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_TEMPERATURE, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Temperature flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the temperature data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->w = ((float) axisVal) / scale;
-
+    sensor->w = meOutAxis(data, recip);
     return 0;
 }
 
@@ -303,41 +239,15 @@ LIBFREESPACE_API int freespace_util_getTemperature(struct freespace_MotionEngine
 LIBFREESPACE_API int freespace_util_getInclination(struct freespace_MotionEngineOutput const * meOutPkt,
                                                    struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 1:
-        scale = 10.0; // 0.1 degrees
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over mag
-        if (meOutPkt->ff4 == 0) {
-            offset = -1; // Inclination flag not set
-        }
-        break;
-    case 0:
-    case 2:
-    case 3:
-        return -2; // No calibrated inclination in this format
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_INCLINATION, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Inclination flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the inclination data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-    sensor->y = ((float) axisVal) / scale;
-    axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-    sensor->z = ((float) axisVal) / scale;
-
+    meOutXYZ(data, recip, sensor);
     return 0;
 }
 
@@ -347,38 +257,15 @@ LIBFREESPACE_API int freespace_util_getInclination(struct freespace_MotionEngine
 LIBFREESPACE_API int freespace_util_getCompassHeading(struct freespace_MotionEngineOutput const * meOutPkt,
                                                       struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 1:
-        scale = 10.0; // 0.1 degrees
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over mag
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over inclination
-        if (meOutPkt->ff5 == 0) {
-            offset = -1; // Compass heading flag not set
-        }
-        break;
-    case 0:
-    case 2:
-    case 3:
-        return -2; // No calibrated compass heading in this format
-    default:
-        return -3; // The format number was unrecognized
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_COMPASS_HEADING, &data, &recip);
 
-    if (offset < 0) {
-        return -1; // Compass heading flag not set
+    if (rc != 0) {
+        return rc;
     }
 
-    // Extract and convert the compass heading data
-    axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-    sensor->x = ((float) axisVal) / scale;
-
+    sensor->x = meOutAxis(data, recip);
     return 0;
 }
 
@@ -388,67 +275,15 @@ LIBFREESPACE_API int freespace_util_getCompassHeading(struct freespace_MotionEng
 LIBFREESPACE_API int freespace_util_getAngPos(struct freespace_MotionEngineOutput const * meOutPkt,
                                                     struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int16_t axisVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 0:
-    case 3:
-        scale = 16384.0;
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over mouse
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over mag
-        offset = (meOutPkt->ff5 == 1) ? offset + 2 : offset; // Skip over temperature
-        if (meOutPkt->ff6 == 0) {
-            offset = -1; // Angular position flag not set
-        }
-        break;
-    case 1:
-        scale = 16384.0;
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over mag
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over inclination
-        offset = (meOutPkt->ff5 == 1) ? offset + 2 : offset; // Skip over compass
-        if (meOutPkt->ff6 == 0) {
-            offset = -1; // Angular position flag not set
-        }
-        break;
-    case 2: 
-        return -2; // No angular position in this format
-    default:
-        return -3; // The format number was unrecognized
-    }
-
-    if (offset < 0) {
-        return -1; // Angular position flag not set
-    }
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_ANG_POS, &data, &recip);
 
-    // Extract and convert the angular position data
-    if (meOutPkt->formatSelect == 1) {
-        axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-        sensor->x = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-        sensor->y = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-        sensor->z = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 7] << 8 |  meOutPkt->meData[offset + 6];
-        sensor->w = ((float) axisVal) / scale;
-    } else {
-        axisVal = meOutPkt->meData[offset + 1] << 8 |  meOutPkt->meData[offset + 0];
-        sensor->w = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 3] << 8 |  meOutPkt->meData[offset + 2];
-        sensor->x = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 5] << 8 |  meOutPkt->meData[offset + 4];
-        sensor->y = ((float) axisVal) / scale;
-        axisVal = meOutPkt->meData[offset + 7] << 8 |  meOutPkt->meData[offset + 6];
-        sensor->z = ((float) axisVal) / scale;
+    if (rc != 0) {
+        return rc;
     }
 
+    meOutAngPos(meOutPkt, data, recip, sensor);
     return 0;
 }
 
@@ -458,41 +293,243 @@ LIBFREESPACE_API int freespace_util_getAngPos(struct freespace_MotionEngineOutpu
 LIBFREESPACE_API int freespace_util_getActClass(struct freespace_MotionEngineOutput const * meOutPkt,
                                                 struct MultiAxisSensor * sensor) {
 
-    int offset = 0; // default value of 0; if < 0 then offset is not valid
-    int8_t flagVal;
-    float scale;
-
-    switch(meOutPkt->formatSelect) {
-    case 1:
-        scale = 1.0; // Q0
-        offset = (meOutPkt->ff0 == 1) ? offset + 6 : offset; // Skip over acc
-        offset = (meOutPkt->ff1 == 1) ? offset + 6 : offset; // Skip over lin acc
-        offset = (meOutPkt->ff2 == 1) ? offset + 6 : offset; // Skip over ang vel
-        offset = (meOutPkt->ff3 == 1) ? offset + 6 : offset; // Skip over mag
-        offset = (meOutPkt->ff4 == 1) ? offset + 6 : offset; // Skip over inclination
-        offset = (meOutPkt->ff5 == 1) ? offset + 2 : offset; // Skip over compass
-        offset = (meOutPkt->ff6 == 1) ? offset + 8 : offset; // Skip over ang pos
-        if (meOutPkt->ff7 == 0) {
-            offset = -1; // Act class flag not set
-        }
-        break;
-    case 0:
-    case 2:
-    case 3:
-        return -2; // No activity classification in this format
-    default:
-        return -3; // The format number was unrecognized
+    uint8_t const * data;
+    double recip;
+    int rc = meOutSection(meOutPkt, ME_SECTION_ACT_CLASS, &data, &recip);
+
+    if (rc != 0) {
+        return rc;
     }
 
-    if (offset < 0) {
-        return -1; // Act class flag not set
+    meOutActClass(data, sensor);
+    return 0;
+}
+
+/******************************************************************************
+ * freespace_util_getAccelerationRaw
+ */
+LIBFREESPACE_API int freespace_util_getAccelerationRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_ACCELERATION, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getAccNoGravityRaw
+ */
+LIBFREESPACE_API int freespace_util_getAccNoGravityRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_ACC_NO_GRAVITY, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getAngularVelocityRaw
+ */
+LIBFREESPACE_API int freespace_util_getAngularVelocityRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                          struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_ANGULAR_VELOCITY, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getMagnetometerRaw
+ */
+LIBFREESPACE_API int freespace_util_getMagnetometerRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_MAGNETOMETER, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getTemperatureRaw
+ */
+LIBFREESPACE_API int freespace_util_getTemperatureRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                      struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_TEMPERATURE, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getInclinationRaw
+ */
+LIBFREESPACE_API int freespace_util_getInclinationRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                      struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_INCLINATION, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getCompassHeadingRaw
+ */
+LIBFREESPACE_API int freespace_util_getCompassHeadingRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                         struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_COMPASS_HEADING, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getAngPosRaw
+ */
+LIBFREESPACE_API int freespace_util_getAngPosRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                 struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_ANG_POS, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_getActClassRaw
+ */
+LIBFREESPACE_API int freespace_util_getActClassRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                   struct MultiAxisSensorRaw * sensor) {
+    return meOutRawSection(meOutPkt, ME_SECTION_ACT_CLASS, sensor);
+}
+
+/******************************************************************************
+ * freespace_util_decodeAll
+ */
+LIBFREESPACE_API int freespace_util_decodeAll(struct freespace_MotionEngineOutput const * meOutPkt,
+                                              struct freespace_MEOutputAll * all) {
+
+    const struct MEOutLayout * layout;
+    const double * recip;
+    uint8_t const * data = meOutPkt->meData;
+
+    if (meOutPkt->formatSelect >= 4) {
+        return -3; // The format number was unrecognized
     }
+    layout = &meLayouts[meOutPkt->formatSelect][meOutFlags(meOutPkt)];
+    recip = meScaleRecip[meOutPkt->formatSelect];
 
-    flagVal = meOutPkt->meData[offset + 0]; // Act Class Flags
-    sensor->x = ((float) flagVal) / scale;
-    flagVal = meOutPkt->meData[offset + 1]; // Power Mgmt Flags
-    sensor->y = ((float) flagVal) / scale;
+    if (layout->present & FREESPACE_UTIL_ACCELERATION) {
+        meOutXYZ(&data[layout->offset[ME_SECTION_ACCELERATION]], recip[ME_SECTION_ACCELERATION], &all->acceleration);
+    }
+    if (layout->present & FREESPACE_UTIL_ACC_NO_GRAVITY) {
+        meOutXYZ(&data[layout->offset[ME_SECTION_ACC_NO_GRAVITY]], recip[ME_SECTION_ACC_NO_GRAVITY], &all->accNoGravity);
+    }
+    if (layout->present & FREESPACE_UTIL_ANGULAR_VELOCITY) {
+        meOutXYZ(&data[layout->offset[ME_SECTION_ANGULAR_VELOCITY]], recip[ME_SECTION_ANGULAR_VELOCITY], &all->angularVelocity);
+    }
+    if (layout->present & FREESPACE_UTIL_MAGNETOMETER) {
+        meOutXYZ(&data[layout->offset[ME_SECTION_MAGNETOMETER]], recip[ME_SECTION_MAGNETOMETER], &all->magnetometer);
+    }
+    if (layout->present & FREESPACE_UTIL_TEMPERATURE) {
+        all->temperature.w = meOutAxis(&data[layout->offset[ME_SECTION_TEMPERATURE]], recip[ME_SECTION_TEMPERATURE]);
+    }
+    if (layout->present & FREESPACE_UTIL_INCLINATION) {
+        meOutXYZ(&data[layout->offset[ME_SECTION_INCLINATION]], recip[ME_SECTION_INCLINATION], &all->inclination);
+    }
+    if (layout->present & FREESPACE_UTIL_COMPASS_HEADING) {
+        all->compassHeading.x = meOutAxis(&data[layout->offset[ME_SECTION_COMPASS_HEADING]], recip[ME_SECTION_COMPASS_HEADING]);
+    }
+    if (layout->present & FREESPACE_UTIL_ANG_POS) {
+        meOutAngPos(meOutPkt, &data[layout->offset[ME_SECTION_ANG_POS]], recip[ME_SECTION_ANG_POS], &all->angPos);
+    }
+    if (layout->present & FREESPACE_UTIL_ACT_CLASS) {
+        meOutActClass(&data[layout->offset[ME_SECTION_ACT_CLASS]], &all->actClass);
+    }
 
-    return 0;
+    return layout->present;
 }
 
+/******************************************************************************
+ * freespace_util_convertBatch
+ */
+LIBFREESPACE_API int freespace_util_convertBatch(struct freespace_MotionEngineOutput const * meOutPkts,
+                                                 int count,
+                                                 int sections,
+                                                 struct freespace_MEOutputColumns * columns) {
+
+    const struct MEOutLayout * layout;
+    const double * recip;
+    const uint8_t * base = (const uint8_t *) meOutPkts;
+    const int stride = sizeof(struct freespace_MotionEngineOutput);
+    int flags;
+    int converted;
+    int i;
+
+    if (count <= 0) {
+        return 0;
+    }
+    if (meOutPkts[0].formatSelect >= 4) {
+        return -3; // The format number was unrecognized
+    }
+    flags = meOutFlags(&meOutPkts[0]);
+    for (i = 1; i < count; i++) {
+        if (meOutPkts[i].formatSelect != meOutPkts[0].formatSelect || meOutFlags(&meOutPkts[i]) != flags) {
+            return -4; // The packets do not share one layout
+        }
+    }
+
+    layout = &meLayouts[meOutPkts[0].formatSelect][flags];
+    recip = meScaleRecip[meOutPkts[0].formatSelect];
+    converted = sections & layout->present;
+
+    for (i = 0; i < ME_SECTION_COUNT; i++) {
+        float * axes[4];
+        float scale[4];
+        int axisCount;
+        int offset;
+        int k;
+
+        if ((converted & (1 << i)) == 0) {
+            continue;
+        }
+        offset = offsetof(struct freespace_MotionEngineOutput, meData) + layout->offset[i];
+
+        switch (i) {
+        case ME_SECTION_ACCELERATION:
+            memcpy(axes, columns->acceleration, sizeof(columns->acceleration));
+            axisCount = 3;
+            break;
+        case ME_SECTION_ACC_NO_GRAVITY:
+            memcpy(axes, columns->accNoGravity, sizeof(columns->accNoGravity));
+            axisCount = 3;
+            break;
+        case ME_SECTION_ANGULAR_VELOCITY:
+            memcpy(axes, columns->angularVelocity, sizeof(columns->angularVelocity));
+            axisCount = 3;
+            break;
+        case ME_SECTION_MAGNETOMETER:
+            memcpy(axes, columns->magnetometer, sizeof(columns->magnetometer));
+            axisCount = 3;
+            break;
+        case ME_SECTION_TEMPERATURE:
+            axes[0] = columns->temperature;
+            axisCount = 1;
+            break;
+        case ME_SECTION_INCLINATION:
+            memcpy(axes, columns->inclination, sizeof(columns->inclination));
+            axisCount = 3;
+            break;
+        case ME_SECTION_COMPASS_HEADING:
+            axes[0] = columns->compassHeading;
+            axisCount = 1;
+            break;
+        case ME_SECTION_ANG_POS:
+            // Format 1 sends the quaternion as X, Y, Z, W; the others as W, X, Y, Z
+            if (meOutPkts[0].formatSelect == 1) {
+                axes[0] = columns->angPos[1];
+                axes[1] = columns->angPos[2];
+                axes[2] = columns->angPos[3];
+                axes[3] = columns->angPos[0];
+            } else {
+                memcpy(axes, columns->angPos, sizeof(columns->angPos));
+            }
+            axisCount = 4;
+            break;
+        case ME_SECTION_ACT_CLASS:
+        default:
+            // The activity classification is a pair of int8 flags rather than int16 axes
+            for (k = 0; k < 2; k++) {
+                int j;
+                if (columns->actClass[k] == NULL) {
+                    continue;
+                }
+                for (j = 0; j < count; j++) {
+                    columns->actClass[k][j] = (float) (int8_t) base[j * stride + offset + k];
+                }
+            }
+            continue;
+        }
+
+        for (k = 0; k < axisCount; k++) {
+            scale[k] = (float) recip[i];
+        }
+        freespace_private_decodeColumns(base, stride, stride, count, offset, axisCount, NULL, axes, scale);
+    }
+
+    return converted;
+}
@@ -0,0 +1,428 @@
+#!/usr/bin/env python
+#
+# This file is part of libfreespace.
+#
+# Copyright (c) 2013 Hillcrest Laboratories, Inc.
+#
+# libfreespace is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+# Generates the MotionEngine Output layout table used by freespace_util.c.
+# For every formatSelect and every combination of the ff0..ff7 format flags
+# the table gives the offset of each section within meData, so that the
+# utility functions never have to walk the flags themselves.
+#
+# Given a list of format:flags configurations it also generates
+# freespace_meTyped.h, with a struct and decoder specialized to each one.
+
+import sys
+import argparse
+import os
+
+# The sections the utility functions extract, in FREESPACE_UTIL_* bit order.
+SECTIONS = [
+    "ACCELERATION",
+    "ACC_NO_GRAVITY",
+    "ANGULAR_VELOCITY",
+    "MAGNETOMETER",
+    "TEMPERATURE",
+    "INCLINATION",
+    "COMPASS_HEADING",
+    "ANG_POS",
+    "ACT_CLASS",
+]
+
+# Size of meData in struct freespace_MotionEngineOutput
+ME_DATA_SIZE = 44
+
+# The fields selected by ff0..ff7 for each format: (section, size in bytes, scale).
+# A section of None is carried in the packet but not extracted by the utility functions.
+FORMATS = {
+    0: [
+        (None,               6, None),     # mouse
+        ("ACCELERATION",     6, 1024.0),   # Q10
+        ("ACC_NO_GRAVITY",   6, 1024.0),   # Q10
+        ("ANGULAR_VELOCITY", 6, 1024.0),   # Q10
+        ("MAGNETOMETER",     6, 4096.0),   # Q12
+        ("TEMPERATURE",      2, 128.0),    # Q7
+        ("ANG_POS",          8, 16384.0),  # Q14
+        (None,               0, None),
+    ],
+    1: [
+        ("ACCELERATION",     6, 100.0),    # 0.01g
+        ("ACC_NO_GRAVITY",   6, 100.0),    # 0.01g
+        ("ANGULAR_VELOCITY", 6, 100.0),
+        ("MAGNETOMETER",     6, 1000.0),   # 0.001 gauss
+        ("INCLINATION",      6, 10.0),     # 0.1 degrees
+        ("COMPASS_HEADING",  2, 10.0),     # 0.1 degrees
+        ("ANG_POS",          8, 16384.0),  # Q14
+        ("ACT_CLASS",        2, 1.0),      # Q0
+    ],
+    # Format 2 carries no calibrated sections
+    2: [],
+    3: [
+        (None,               6, None),     # mouse
+        ("ACCELERATION",     6, 256.0),    # Q8
+        ("ACC_NO_GRAVITY",   6, 256.0),    # Q8
+        ("ANGULAR_VELOCITY", 6, 512.0),    # Q9
+        ("MAGNETOMETER",     6, 32.0),     # Q5
+        ("TEMPERATURE",      2, 128.0),    # Q7
+        ("ANG_POS",          8, 16384.0),  # Q14
+        (None,               0, None),
+    ],
+}
+
+FORMAT_COUNT = 4
+FLAG_COMBINATIONS = 256
+
+def computeLayout(fields, flags):
+    # Returns ({section: offset}, bytes used) for one set of format flags
+    offsets = {}
+    offset = 0
+    for ff, (section, size, scale) in enumerate(fields):
+        if not (flags >> ff) & 1:
+            continue
+        if section is not None:
+            offsets[section] = offset
+        offset += size
+    return offsets, offset
+
+def qFormat(scale):
+    # log2 of a power of two scale, or -1
+    q = 0
+    while (1 << q) < scale:
+        q += 1
+    if (1 << q) != scale:
+        return -1
+    return q
+
+def selfTest(layouts):
+    # Check the generated table against the format definitions before writing it out.
+    for fmt in range(FORMAT_COUNT):
+        fields = FORMATS[fmt]
+        sizes = dict((f[0], f[1]) for f in fields if f[0] is not None)
+        for flags in range(FLAG_COMBINATIONS):
+            offsets, used = layouts[fmt][flags]
+            for (section, size, scale) in fields:
+                if section is not None and scale != int(scale):
+                    raise Exception("format %d: %s scale %f is not an integer" % (fmt, section, scale))
+            if used > ME_DATA_SIZE:
+                raise Exception("format %d flags 0x%02x uses %d bytes of meData" % (fmt, flags, used))
+            # A section is present exactly when its format flag is set
+            for ff, (section, size, scale) in enumerate(fields):
+                if section is not None and (section in offsets) != bool((flags >> ff) & 1):
+                    raise Exception("format %d flags 0x%02x: %s presence does not follow ff%d" % (fmt, flags, section, ff))
+            # Present sections must not overlap and must fit in meData
+            spans = sorted((offsets[s], offsets[s] + sizes[s], s) for s in offsets)
+            for i in range(len(spans)):
+                if spans[i][1] > ME_DATA_SIZE:
+                    raise Exception("format %d flags 0x%02x: %s ends past meData" % (fmt, flags, spans[i][2]))
+                if i > 0 and spans[i][0] < spans[i - 1][1]:
+                    raise Exception("format %d flags 0x%02x: %s overlaps %s" % (fmt, flags, spans[i][2], spans[i - 1][2]))
+            # Clearing a flag must only ever move the following sections back
+            for ff in range(8):
+                if (flags >> ff) & 1:
+                    fewer, _ = layouts[fmt][flags & ~(1 << ff)]
+                    for s in fewer:
+                        if fewer[s] > offsets[s]:
+                            raise Exception("format %d flags 0x%02x: %s moved forward when ff%d was cleared" % (fmt, flags, s, ff))
+
+def writeCopyright(out):
+    out.write('''/*
+ * This file is part of libfreespace.
+ *
+ * Copyright (c) 2013 Hillcrest Laboratories, Inc.
+ *
+ * libfreespace is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+''')
+
+def writeLayout(out, layouts):
+    writeCopyright(out)
+    out.write('''
+// Generated by meLayoutGenerator.py. Private to freespace_util.c.
+
+#ifndef FREESPACE_MELAYOUT_H_
+#define FREESPACE_MELAYOUT_H_
+
+#include "freespace/freespace_util.h"
+
+''')
+    for i, section in enumerate(SECTIONS):
+        out.write("#define ME_SECTION_%s %d\n" % (section, i))
+    out.write("#define ME_SECTION_COUNT %d\n" % len(SECTIONS))
+    out.write('''
+// Offset of each section within meData for one set of format flags, or -1 if absent
+struct MEOutLayout {
+    uint16_t present;
+    int8_t offset[ME_SECTION_COUNT];
+};
+
+// Sections each format can carry at all
+static const uint16_t meFormatSections[%d] = {
+''' % FORMAT_COUNT)
+    for fmt in range(FORMAT_COUNT):
+        mask = 0
+        for (section, size, scale) in FORMATS[fmt]:
+            if section is not None:
+                mask |= 1 << SECTIONS.index(section)
+        out.write("    0x%04x,\n" % mask)
+    out.write('''};
+
+// Reciprocal of each section's scale per format. Kept in double so that the
+// product rounds to the same float as dividing by the scale.
+static const double meScaleRecip[%d][ME_SECTION_COUNT] = {
+''' % FORMAT_COUNT)
+    for fmt in range(FORMAT_COUNT):
+        recips = ["0.0"] * len(SECTIONS)
+        for (section, size, scale) in FORMATS[fmt]:
+            if section is not None:
+                recips[SECTIONS.index(section)] = "1.0 / %.1f" % scale
+        out.write("    { %s },\n" % ", ".join(recips))
+    out.write('''};
+
+// Integer scale of each section per format and its Q format, i.e. log2 of the
+// scale, or -1 where the scale is not a power of two
+static const uint16_t meScale[%d][ME_SECTION_COUNT] = {
+''' % FORMAT_COUNT)
+    for fmt in range(FORMAT_COUNT):
+        scales = ["0"] * len(SECTIONS)
+        for (section, size, scale) in FORMATS[fmt]:
+            if section is not None:
+                scales[SECTIONS.index(section)] = "%d" % scale
+        out.write("    { %s },\n" % ", ".join(scales))
+    out.write('''};
+
+static const int8_t meQFormat[%d][ME_SECTION_COUNT] = {
+''' % FORMAT_COUNT)
+    for fmt in range(FORMAT_COUNT):
+        qs = ["-1"] * len(SECTIONS)
+        for (section, size, scale) in FORMATS[fmt]:
+            if section is not None:
+                qs[SECTIONS.index(section)] = "%d" % qFormat(scale)
+        out.write("    { %s },\n" % ", ".join(qs))
+    out.write('''};
+
+// Indexed by formatSelect, then by ff0..ff7 as bits 0..7
+static const struct MEOutLayout meLayouts[%d][%d] = {
+''' % (FORMAT_COUNT, FLAG_COMBINATIONS))
+    maxUsed = 0
+    for fmt in range(FORMAT_COUNT):
+        out.write("    { // format %d\n" % fmt)
+        for flags in range(FLAG_COMBINATIONS):
+            offsets, used = layouts[fmt][flags]
+            maxUsed = max(maxUsed, used)
+            mask = 0
+            cols = []
+            for i, section in enumerate(SECTIONS):
+                if section in offsets:
+                    mask |= 1 << i
+                    cols.append("%2d" % offsets[section])
+                else:
+                    cols.append("-1")
+            out.write("        { 0x%04x, { %s } },\n" % (mask, ", ".join(cols)))
+        out.write("    },\n")
+    out.write('''};
+
+// Fails to compile if the codecs ever shrink meData below what the table indexes
+typedef char meLayoutFitsMeData[(%d <= sizeof(((struct freespace_MotionEngineOutput*) 0)->meData)) ? 1 : -1];
+
+// Fails to compile if the section numbers drift from the FREESPACE_UTIL_* bits
+typedef char meLayoutMatchesUtilBits[(%s) ? 1 : -1];
+
+#endif /* FREESPACE_MELAYOUT_H_ */
+''' % (maxUsed, " &&\n    ".join("FREESPACE_UTIL_%s == (1 << ME_SECTION_%s)" % (s, s) for s in SECTIONS)))
+
+# Field names for the typed structs, in the order the axes appear in the packet.
+# Format 1 sends the quaternion as X, Y, Z, W; the others as W, X, Y, Z.
+def sectionFields(fmt, section):
+    axes = {
+        "ACCELERATION":     ("acceleration", ["X", "Y", "Z"]),
+        "ACC_NO_GRAVITY":   ("accNoGravity", ["X", "Y", "Z"]),
+        "ANGULAR_VELOCITY": ("angularVelocity", ["X", "Y", "Z"]),
+        "MAGNETOMETER":     ("magnetometer", ["X", "Y", "Z"]),
+        "TEMPERATURE":      ("temperature", [""]),
+        "INCLINATION":      ("inclination", ["X", "Y", "Z"]),
+        "COMPASS_HEADING":  ("compassHeading", [""]),
+        "ANG_POS":          ("angPos", ["X", "Y", "Z", "W"] if fmt == 1 else ["W", "X", "Y", "Z"]),
+    }
+    name, suffixes = axes[section]
+    return [name + suffix for suffix in suffixes]
+
+def parseConfig(config):
+    # "format:flags", e.g. "0:0x7e"
+    try:
+        fmt, flags = config.split(":")
+        fmt = int(fmt, 0)
+        flags = int(flags, 0)
+    except ValueError:
+        raise Usage("Bad MotionEngine configuration '%s', expected format:flags" % config)
+    if fmt < 0 or fmt >= FORMAT_COUNT or flags < 0 or flags >= FLAG_COMBINATIONS:
+        raise Usage("MotionEngine configuration '%s' is out of range" % config)
+    return fmt, flags
+
+def writeTyped(out, layouts, configs):
+    writeCopyright(out)
+    out.write('''
+#ifndef FREESPACE_METYPED_H_
+#define FREESPACE_METYPED_H_
+
+#include "freespace/freespace_codecs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup metyped Typed MotionEngine Output
+ *
+ * Structs and decoders for the MotionEngine Output configurations selected
+ * when libfreespace was built. Each struct holds the sections enabled by one
+ * formatSelect and set of format flags as named float fields, in the units
+ * of the matching freespace_util_get* function. The decoders read meData at
+ * fixed offsets and only check that the packet has that configuration.
+ */
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define FREESPACE_METYPED_INLINE static __inline
+#else
+#define FREESPACE_METYPED_INLINE static inline
+#endif
+
+FREESPACE_METYPED_INLINE int16_t freespace_meTypedInt16(const uint8_t* data) {
+    return (int16_t) (data[1] << 8 | data[0]);
+}
+
+''')
+    for fmt, flags in configs:
+        fields = FORMATS[fmt]
+        offsets, used = layouts[fmt][flags]
+        name = "MEOutFormat%d_%02x" % (fmt, flags)
+        present = [f[0] for f in fields if f[0] in offsets]
+
+        out.write('''
+/** @ingroup metyped
+ * MotionEngine Output with formatSelect %d and format flags 0x%02x.
+ */
+struct freespace_%s {
+''' % (fmt, flags, name))
+        for section in present:
+            if section == "ACT_CLASS":
+                out.write("    /** Activity classification flags */\n    int8_t actClass;\n")
+                out.write("    /** Power management flags */\n    int8_t powerMgmt;\n")
+            else:
+                for field in sectionFields(fmt, section):
+                    out.write("    float %s;\n" % field)
+        if not present:
+            out.write("    /** This configuration carries no calibrated sections */\n    uint8_t unused;\n")
+        out.write("};\n")
+
+        out.write('''
+/** @ingroup metyped
+ * Decode a MotionEngine Output packet with formatSelect %d and format flags 0x%02x.
+ *
+ * @param meOutPkt the packet to decode
+ * @param s where to store the decoded sections
+ * @return FREESPACE_SUCCESS, or FREESPACE_ERROR_MALFORMED_MESSAGE if the packet has another configuration
+ */
+FREESPACE_METYPED_INLINE int freespace_decode%s(const struct freespace_MotionEngineOutput* meOutPkt,
+        struct freespace_%s* s) {
+''' % (fmt, flags, name, name))
+        if present:
+            out.write("    const uint8_t* d = meOutPkt->meData;\n\n")
+        checks = ["meOutPkt->formatSelect != %d" % fmt]
+        checks += ["meOutPkt->ff%d != %d" % (ff, (flags >> ff) & 1) for ff in range(8)]
+        out.write("    if (%s) {\n" % " ||\n        ".join(checks))
+        out.write("        return FREESPACE_ERROR_MALFORMED_MESSAGE;\n    }\n")
+        for (section, size, scale) in fields:
+            if section not in offsets:
+                continue
+            offset = offsets[section]
+            if section == "ACT_CLASS":
+                out.write("    s->actClass = (int8_t) d[%d];\n" % offset)
+                out.write("    s->powerMgmt = (int8_t) d[%d];\n" % (offset + 1))
+                continue
+            for i, field in enumerate(sectionFields(fmt, section)):
+                out.write("    s->%s = (float) (freespace_meTypedInt16(&d[%d]) * (1.0 / %.1f));\n" % (field, offset + 2 * i, scale))
+        if not present:
+            out.write("    (void) s;\n")
+        out.write("    return FREESPACE_SUCCESS;\n}\n")
+
+    out.write('''
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREESPACE_METYPED_H_ */
+''')
+
+class Usage(Exception):
+    def __init__(self, msg):
+        self.msg = msg
+
+def main(argv=None):
+    if argv is None:
+        argv = sys.argv
+
+    try:
+        parser = argparse.ArgumentParser()
+        parser.add_argument("-s", "--src", default="src",
+                            help="Source directory to write the generated layout table to")
+        parser.add_argument("-I", "--include", default=None,
+                            help="Include directory to write the typed MotionEngine header to")
+        parser.add_argument("configs", nargs="*",
+                            help="MotionEngine configurations to generate typed structs for, as format:flags")
+        args = parser.parse_args()
+        configs = []
+        for config in args.configs:
+            parsed = parseConfig(config)
+            if parsed not in configs:
+                configs.append(parsed)
+
+        layouts = [[computeLayout(FORMATS[fmt], flags) for flags in range(FLAG_COMBINATIONS)]
+                   for fmt in range(FORMAT_COUNT)]
+        selfTest(layouts)
+
+        if not os.path.exists(args.src):
+            os.makedirs(args.src)
+        out = open(os.path.join(args.src, "freespace_meLayout.h"), "w")
+        writeLayout(out, layouts)
+        out.close()
+
+        if args.include is not None:
+            includeDir = os.path.join(args.include, "freespace")
+            if not os.path.exists(includeDir):
+                os.makedirs(includeDir)
+            out = open(os.path.join(includeDir, "freespace_meTyped.h"), "w")
+            writeTyped(out, layouts, configs)
+            out.close()
+    except Usage, err:
+        print >>sys.stderr, err.msg
+        print >>sys.stderr, "for help use --help"
+        return 2
+
+if __name__ == "__main__":
+    sys.exit(main())
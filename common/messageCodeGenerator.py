@@ -22,6 +22,9 @@ import sys
 import argparse
 import os
 
+# The only HID protocol version to generate code for, or None for all of them
+singleVersion = None
+
 def compareMessages(a, b):
     # Sort ID[0] before ID[1] before ID[2]
     if len(a.ID[0]) != 0:
@@ -62,14 +65,18 @@ class MessageCodeGenerator:
 
     def writeMessages(self, messages):
         messages.sort(compareMessages)
+        if singleVersion is not None:
+            restrictVersion(messages, singleVersion)
 
 
         codecsFileName = "freespace_codecs"
         printersFileName = "freespace_printers"
+        viewsFileName = "freespace_views"
         codecsHdrPath = os.path.join(self.inclDir, codecsFileName + ".h")
         printerHdrPath = os.path.join(self.inclDir, printersFileName + ".h")
         codecsSrcPath = os.path.join(self.srcDir, codecsFileName + ".c")
         printersSrcPath = os.path.join(self.srcDir, printersFileName + ".c")
+        viewsHdrPath = os.path.join(self.inclDir, viewsFileName + ".h")
 
         codecsHFile = open(codecsHdrPath, "w")
         self.writeHFileHeader(codecsHFile, codecsFileName)
@@ -85,6 +92,7 @@ class MessageCodeGenerator:
         self.writeCFileHeader(codecsCFile, codecsFileName)
         codecsCFile.write('#include <stdio.h>\n')
         codecsCFile.write('#include <math.h>\n')
+        codecsCFile.write('#include <stddef.h>\n')
         codecsCFile.write('\n#ifdef _WIN32\n')
         codecsCFile.write('#define STRICT_DECODE_LENGTH 0\n')
         codecsCFile.write('#else\n')
@@ -101,23 +109,57 @@ class MessageCodeGenerator:
         
         printersCFile = open(printersSrcPath, "w")
         self.writeCFileHeader(printersCFile, printersFileName)
+        printersCFile.write('#include <stdlib.h>\n')
         self.writePrintMessageBody(messages, printersCFile)
+
+        viewsHFile = open(viewsHdrPath, "w")
+        self.writeHFileHeader(viewsHFile, viewsFileName)
+        self.writeViewsHeader(viewsHFile)
         
         for message in messages:
             fields = extractFields(message)
             # Data structure to hold the message
             writeStruct(message, fields, codecsHFile)
 
+        if singleVersion is not None:
+            codecsHFile.write('''
+/** @ingroup messages
+ * Defined when the codecs only support one HID protocol version. Every other
+ * version is rejected with FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION.
+ */
+#define FREESPACE_HID_VERSION_ONLY %d
+''' % singleVersion)
+
         self.writeUnionStruct(codecsHFile, messages)
+        self.writeReflectionHeader(codecsHFile, messages)
+
+        self.writeSerializerBodies(messages, printersCFile)
 
         for message in messages:
+            # Messages left out of the allowlist keep their struct and enum
+            # value, but get no codecs, printers or dispatch entries.
+            if not message.enabled:
+                if message.decode:
+                    writeColumnsStruct(message, extractFields(message), codecsHFile)
+                continue
             writeCodecs(message, codecsHFile, codecsCFile)
             writePrinter(message, printersHFile, printersCFile)
+            if message.decode:
+                writeViews(message, viewsHFile)
 
         self.writeUnionDecodeEncodeBodies(codecsCFile, messages)
+        self.writeCompactBodies(codecsCFile, messages)
+        self.writeReflectionBodies(codecsCFile, messages)
             
         self.writeHFileTrailer(codecsHFile, codecsFileName)
         self.writeHFileTrailer(printersHFile, printersFileName)
+        self.writeHFileTrailer(viewsHFile, viewsFileName)
+        viewsHFile.close()
+
+        cppHFile = open(os.path.join(self.inclDir, codecsFileName + ".hpp"), "w")
+        writeCppHeader(messages, cppHFile)
+        cppHFile.close()
+
         codecsHFile.close()
         codecsCFile.close()
         printersHFile.close()
@@ -177,6 +219,28 @@ static uint8_t byteFromNibbles(uint8_t lsn, uint8_t msn) {
     return lsn | (msn << 4);
 }
 
+// A = sqrt(16384^2 - (B^2 + C^2 + D^2)), truncated. The square root is taken
+// in single precision and then corrected to the exact integer result.
+// Returns 0 if B, C and D are too large to come from a unit quaternion.
+static int16_t synthesizeQuaternionA(int32_t b, int32_t c, int32_t d) {
+    uint32_t sum = (uint32_t) (b * b) + (uint32_t) (c * c) + (uint32_t) (d * d);
+    int32_t n;
+    int32_t a;
+
+    if (sum >= 268435456) {
+        return 0;
+    }
+    n = 268435456 - (int32_t) sum;
+    a = (int32_t) sqrtf((float) n);
+    while (a * a > n) {
+        a--;
+    }
+    while ((a + 1) * (a + 1) <= n) {
+        a++;
+    }
+    return (int16_t) a;
+}
+
 
 ''')
 
@@ -217,8 +281,8 @@ static void printUnknown(const char* name, const uint8_t* buffer, int length) {
 int freespace_printMessageStr(char* dest, int maxlen, const struct freespace_message* s) {
     switch(s->messageType) {''')
         for message in messages:
-            #if (not message.decode):
-            #    continue
+            if not message.enabled:
+                continue
             outFile.write('''
     case %(enumName)s:
         return freespace_print%(messageName)sStr(dest, maxlen, &(s->%(structName)s));
@@ -244,6 +308,168 @@ void freespace_printMessage(FILE* fp, const struct freespace_message * s) {
 
 ''')
     
+    def writeSerializerBodies(self, messages, outFile):
+        outFile.write('''
+// Make room for extra more bytes in b.
+static int reserveOutput(struct freespace_outputBuffer* b, int extra) {
+    char* data;
+    int capacity;
+
+    if (b->length + extra <= b->capacity) {
+        return FREESPACE_SUCCESS;
+    }
+    capacity = b->capacity * 2;
+    if (capacity < b->length + extra) {
+        capacity = b->length + extra;
+    }
+    if (capacity < 256) {
+        capacity = 256;
+    }
+    data = (char*) realloc(b->data, capacity);
+    if (data == NULL) {
+        return FREESPACE_ERROR_OUT_OF_MEMORY;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return FREESPACE_SUCCESS;
+}
+
+LIBFREESPACE_API void freespace_freeOutputBuffer(struct freespace_outputBuffer* b) {
+    free(b->data);
+    b->data = NULL;
+    b->length = 0;
+    b->capacity = 0;
+}
+
+LIBFREESPACE_API int freespace_serializeMessage(struct freespace_outputBuffer* b, const struct freespace_message* s) {
+    int rc = freespace_compactSize(s->messageType);
+
+    if (rc < 0) {
+        return rc;
+    }
+    rc = reserveOutput(b, rc);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+    rc = freespace_compactMessage(s, (uint8_t*) b->data + b->length, b->capacity - b->length);
+    if (rc > 0) {
+        b->length += rc;
+    }
+    return rc;
+}
+
+// Write the decimal digits of v at p and return the end of the digits.
+// Each call writes at most JSON_INT_SIZE characters.
+#define JSON_INT_SIZE 11
+
+static char* jsonUint(char* p, uint32_t v) {
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = (char) ('0' + v %% 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char* jsonInt(char* p, int32_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return jsonUint(p, 0u - (uint32_t) v);
+    }
+    return jsonUint(p, (uint32_t) v);
+}
+
+// The longest message header, {"type":"<name>","ver":,"len":,"dest":,"src":
+// with room for the numbers.
+#define JSON_HEADER_SIZE (%d + 4 * JSON_INT_SIZE)
+
+static char* jsonHeader(char* p, const char* name, int nameLength, const struct freespace_message* s) {
+    memcpy(p, "{\\"type\\":\\"", 9);
+    p += 9;
+    memcpy(p, name, nameLength);
+    p += nameLength;
+    memcpy(p, "\\",\\"ver\\":", 8);
+    p = jsonUint(p + 8, s->ver);
+    memcpy(p, ",\\"len\\":", 7);
+    p = jsonUint(p + 7, s->len);
+    memcpy(p, ",\\"dest\\":", 8);
+    p = jsonUint(p + 8, s->dest);
+    memcpy(p, ",\\"src\\":", 7);
+    return jsonUint(p + 7, s->src);
+}
+''' % (9 + max([len(m.name) for m in messages]) + 8 + 7 + 8 + 7))
+
+        for message in messages:
+            if not message.enabled:
+                continue
+            fields = extractFields(message)
+            size = 0
+            lines = []
+            for field in fields:
+                key = ',\\"%s\\":' % field['name']
+                keyLength = len(field['name']) + 4
+                lines.append("    memcpy(p, \"%s\", %d);\n    p += %d;\n" % (key, keyLength, keyLength))
+                size += keyLength
+                writer = "jsonUint" if field['type'] == 'uint32_t' else "jsonInt"
+                if field['count'] == 1:
+                    lines.append("    p = %s(p, s->%s);\n" % (writer, field['name']))
+                    size += 11
+                else:
+                    lines.append('''    *p++ = '[';
+    for (i = 0; i < %(count)d; i++) {
+        if (i != 0) {
+            *p++ = ',';
+        }
+        p = %(writer)s(p, s->%(name)s[i]);
+    }
+    *p++ = ']';
+''' % {'count':field['count'], 'writer':writer, 'name':field['name']})
+                    size += 2 + field['count'] * 12
+            outFile.write('''
+static char* json%(name)s(char* p, const struct freespace_%(name)s* s) {
+%(decl)s%(body)s    return p;
+}
+''' % {'name':message.name, 'body':"".join(lines),
+       'decl':"    int i;\n\n" if len([f for f in fields if f['count'] != 1]) else ""})
+            message.jsonSize = size
+
+        outFile.write('''
+LIBFREESPACE_API int freespace_serializeMessageJson(struct freespace_outputBuffer* b, const struct freespace_message* s) {
+    char* p;
+    char* start;
+    int rc;
+
+    switch (s->messageType) {''')
+        for message in messages:
+            if not message.enabled:
+                continue
+            outFile.write('''
+    case %(enumName)s:
+        rc = reserveOutput(b, JSON_HEADER_SIZE + %(size)d + 2);
+        if (rc != FREESPACE_SUCCESS) {
+            return rc;
+        }
+        start = b->data + b->length;
+        p = jsonHeader(start, "%(name)s", %(nameLength)d, s);
+        p = json%(name)s(p, &(s->%(structName)s));
+        break;''' % {'enumName':message.enumName, 'size':message.jsonSize, 'name':message.name,
+                      'nameLength':len(message.name), 'structName':message.structName})
+        outFile.write('''
+    default:
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    *p++ = '}';
+    *p++ = '\\n';
+    b->length += (int) (p - start);
+    return (int) (p - start);
+}
+''')
+
     def writePrintMessageHeader(self, outFile):
         outFile.write('''
 /**
@@ -264,8 +490,64 @@ LIBFREESPACE_API void freespace_printMessage(FILE* fp, const struct freespace_me
  */
 LIBFREESPACE_API int freespace_printMessageStr(char* dest, int maxlen, const struct freespace_message* s);
 
+/**
+ * A caller owned buffer that the serializers append to. Start with all
+ * members 0 or with a buffer allocated by malloc. The serializers grow it
+ * with realloc as needed. Release it with freespace_freeOutputBuffer.
+ */
+struct freespace_outputBuffer {
+    char* data;
+    int length;     /**< The number of bytes used */
+    int capacity;   /**< The number of bytes allocated */
+};
+
+/**
+ * Release the memory held by an output buffer and reset it to empty.
+ *
+ * @param b the buffer
+ */
+LIBFREESPACE_API void freespace_freeOutputBuffer(struct freespace_outputBuffer* b);
+
+/**
+ * Append a message in binary form. This is the compact form written by
+ * freespace_compactMessage, and freespace_expandMessage reads it back.
+ *
+ * @param b the buffer to append to
+ * @param s the message
+ * @return the number of bytes appended or an error code
+ */
+LIBFREESPACE_API int freespace_serializeMessage(struct freespace_outputBuffer* b, const struct freespace_message* s);
+
+/**
+ * Append a message as one line of JSON, for example
+ * {"type":"LinkStatus","ver":1,"len":0,"dest":0,"src":0,"status":1,...}
+ * followed by a newline. Array fields are written as JSON arrays.
+ *
+ * @param b the buffer to append to
+ * @param s the message
+ * @return the number of bytes appended or an error code
+ */
+LIBFREESPACE_API int freespace_serializeMessageJson(struct freespace_outputBuffer* b, const struct freespace_message* s);
+
 ''')
     
+    def writeViewsHeader(self, outFile):
+        outFile.write('''/**
+ * @defgroup views Message Views
+ *
+ * Accessors that read single fields straight out of a received report
+ * without decoding the whole message. Each checks the protocol version,
+ * the report ID and sub ID, and that the field lies within the report.
+ */
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define FREESPACE_VIEW_INLINE static __inline
+#else
+#define FREESPACE_VIEW_INLINE static inline
+#endif
+
+''')
+
     def writeDoxygenModuleDef(self, outFile):
         outFile.write('''
 /**
@@ -319,10 +601,61 @@ struct freespace_message {
  * @param length the length of the received message
  * @param s the preallocated freespace_message struct to decode into
  * @param ver the HID protocol version to use to decode the message
- * @return FREESPACE_SUCESS or an error code
+ * @return FREESPACE_SUCESS or an error code. Reports too short for their
+ *         type, including ones that end before their sub ID, return
+ *         FREESPACE_ERROR_BUFFER_TOO_SMALL.
  */
 LIBFREESPACE_API int freespace_decode_message(const uint8_t* message, int length, struct freespace_message* s, uint8_t ver);
 
+/** @ingroup messages
+ * Get the type of a received message without decoding it. This only looks
+ * at the report ID and sub ID, so it is cheap enough to filter reports
+ * before deciding to decode them. It does not check that the message is
+ * long enough to decode.
+ *
+ * @param message the message that was received from the Freespace device
+ * @param length the length of the received message
+ * @param ver the HID protocol version to use to decode the message
+ * @return the MessageTypes value or an error code
+ */
+LIBFREESPACE_API int freespace_peekMessageType(const uint8_t* message, int length, uint8_t ver);
+
+/** @ingroup messages
+ * Decode flag: do not compute synthesized fields, such as UserFrame.angularPosA,
+ * that are derived from other fields rather than sent by the device. They are
+ * set to 0 instead and can be computed on demand with the matching
+ * freespace_synthesize<Message><Field>() function.
+ */
+#define FREESPACE_DECODE_SKIP_SYNTHESIZED 0x01
+
+/** @ingroup messages
+ * Decode an arbitrary message like freespace_decode_message(), with flags
+ * that apply to this call only.
+ *
+ * @param message the message to decode that was received from the Freespace device
+ * @param length the length of the received message
+ * @param s the preallocated freespace_message struct to decode into
+ * @param ver the HID protocol version to use to decode the message
+ * @param flags a combination of FREESPACE_DECODE_* flags, or 0
+ * @return FREESPACE_SUCESS or an error code
+ */
+LIBFREESPACE_API int freespace_decode_messageEx(const uint8_t* message, int length, struct freespace_message* s, uint8_t ver, int flags);
+
+/** @ingroup messages
+ * Decode a batch of reports that all hold the same type of message into
+ * columns, one array per field. See freespace_decodeBatch<Message>()
+ * for the layout of reports and columns.
+ *
+ * @param messageType the MessageTypes value of the reports
+ * @param reports count reports, stride bytes apart
+ * @param stride the distance between the start of consecutive reports
+ * @param count the number of reports
+ * @param ver the HID protocol version to use to decode the reports
+ * @param columns the freespace_<Message>Columns struct for messageType
+ * @return FREESPACE_SUCCESS or an error code
+ */
+LIBFREESPACE_API int freespace_decode_batch(int messageType, const uint8_t* reports, int stride, int count, uint8_t ver, void* columns);
+
 /** @ingroup messages
  * Encode an arbitrary message.
  *
@@ -333,70 +666,451 @@ LIBFREESPACE_API int freespace_decode_message(const uint8_t* message, int length
  */
 LIBFREESPACE_API int freespace_encode_message(struct freespace_message* message, uint8_t* msgBuf, int maxLength);
 
+/** @ingroup messages
+ * The size of the header at the start of every compact message. It holds
+ * the messageType, ver, len, dest and src of the freespace_message.
+ */
+#define FREESPACE_COMPACT_HEADER_SIZE 5
+
+/** @ingroup messages
+ * Get the number of bytes a message of the given type takes in compact form,
+ * including the header. Compact messages hold only the fields of their own
+ * type, packed without padding, so they are usually much smaller than
+ * struct freespace_message. They are meant for queues of decoded messages.
+ *
+ * @param messageType the MessageTypes value
+ * @return the compact size or FREESPACE_ERROR_MALFORMED_MESSAGE for an unknown type
+ */
+LIBFREESPACE_API int freespace_compactSize(int messageType);
+
+/** @ingroup messages
+ * Convert a decoded message to compact form.
+ *
+ * @param message the decoded message
+ * @param buf the buffer to write the compact message to
+ * @param maxLength the size of buf
+ * @return the number of bytes written or an error code
+ */
+LIBFREESPACE_API int freespace_compactMessage(const struct freespace_message* message, uint8_t* buf, int maxLength);
+
+/** @ingroup messages
+ * Convert a compact message back to a full freespace_message.
+ *
+ * @param buf the compact message
+ * @param length the number of bytes available in buf
+ * @param message the struct to expand into
+ * @return the number of bytes consumed from buf or an error code
+ */
+LIBFREESPACE_API int freespace_expandMessage(const uint8_t* buf, int length, struct freespace_message* message);
+
 ''')
 
-    def writeUnionDecodeEncodeBodies(self, file, messages):
+    def writeReflectionHeader(self, file, messages):
         file.write('''
-LIBFREESPACE_API int freespace_decode_message(const uint8_t* message, int length, struct freespace_message* s, uint8_t ver) {
-    if (length == 0) {
-        return -1;
+/** @ingroup messages
+ * The number of MessageTypes values.
+ */
+#define FREESPACE_MESSAGE_TYPE_COUNT %d
+
+/** @ingroup messages
+ * The C type of a field in its message struct.
+ */
+enum freespace_fieldType {
+    FREESPACE_FIELD_UINT8,
+    FREESPACE_FIELD_INT8,
+    FREESPACE_FIELD_UINT16,
+    FREESPACE_FIELD_INT16,
+    FREESPACE_FIELD_UINT32,
+    FREESPACE_FIELD_INT32,
+    FREESPACE_FIELD_INT       /**< A multi-bit field stored as an int */
+};
+
+/** @ingroup messages
+ * Where a field is found in a report of one HID protocol version.
+ */
+struct freespace_fieldWire {
+    int16_t offset;     /**< Byte offset in the report, or -1 if the field is not sent in this version */
+    uint8_t width;      /**< Bytes per element for integer fields, 0 for bit fields */
+    uint8_t shift;      /**< Bit position of a bit field within its byte */
+    uint8_t mask;       /**< Mask of a bit field after shifting */
+};
+
+/** @ingroup messages
+ * Metadata for one field of a message struct.
+ */
+struct freespace_fieldInfo {
+    const char* name;
+    int type;                           /**< A freespace_fieldType value */
+    uint16_t structOffset;              /**< offsetof() the field in the message struct */
+    uint8_t structSize;                 /**< sizeof() one element in the message struct */
+    uint8_t count;                      /**< The number of elements, 1 for scalars */
+    struct freespace_fieldWire wire[3]; /**< The field layout, indexed by HID protocol version */
+};
+
+/** @ingroup messages
+ * freespace_messageInfo flag: the message can be decoded.
+ */
+#define FREESPACE_MESSAGE_INFO_DECODE 0x01
+
+/** @ingroup messages
+ * freespace_messageInfo flag: the message can be encoded.
+ */
+#define FREESPACE_MESSAGE_INFO_ENCODE 0x02
+
+/** @ingroup messages
+ * Metadata for one message type, for table driven loggers, serializers
+ * and column extractors.
+ */
+struct freespace_messageInfo {
+    const char* name;
+    int messageType;
+    uint16_t structSize;                        /**< sizeof() the message struct */
+    uint8_t size[3];                            /**< Report size by HID protocol version, 0 if not defined */
+    uint8_t flags;                              /**< FREESPACE_MESSAGE_INFO_* flags */
+    int fieldCount;
+    const struct freespace_fieldInfo* fields;
+};
+
+/** @ingroup messages
+ * Get the metadata for a message type.
+ *
+ * @param messageType the MessageTypes value
+ * @return the metadata or NULL for an unknown type
+ */
+LIBFREESPACE_API const struct freespace_messageInfo* freespace_getMessageInfo(int messageType);
+''' % len(messages))
+
+    def writeReflectionBodies(self, file, messages):
+        fieldTypes = {'uint8_t':'FREESPACE_FIELD_UINT8', 'int8_t':'FREESPACE_FIELD_INT8',
+                      'uint16_t':'FREESPACE_FIELD_UINT16', 'int16_t':'FREESPACE_FIELD_INT16',
+                      'uint32_t':'FREESPACE_FIELD_UINT32', 'int32_t':'FREESPACE_FIELD_INT32',
+                      'int':'FREESPACE_FIELD_INT'}
+        for message in messages:
+            fields = extractFields(message)
+            if len(fields) == 0:
+                continue
+            layouts = [{}, {}, {}]
+            for v in range(3):
+                if len(message.ID[v]):
+                    for item in messageLayout(message, v):
+                        layouts[v][item['name']] = item
+            file.write("\nstatic const struct freespace_fieldInfo %sFields[%d] = {\n" % (message.structName, len(fields)))
+            for field in fields:
+                wire = []
+                for v in range(3):
+                    item = layouts[v].get(field['name'])
+                    if item is None:
+                        wire.append("{-1, 0, 0, 0}")
+                    elif item['kind'] == 'int':
+                        wire.append("{%d, %d, 0, 0}" % (item['offset'], item['width']))
+                    else:
+                        wire.append("{%d, 0, %d, 0x%02X}" % (item['offset'], item['shift'], item['mask']))
+                file.write('''    {"%(field)s", %(type)s, offsetof(struct freespace_%(name)s, %(field)s), sizeof(((struct freespace_%(name)s*) 0)->%(field)s) / %(count)d, %(count)d,
+        {%(wire)s}},
+''' % {'field':field['name'], 'type':fieldTypes[field['type']], 'name':message.name,
+       'count':field['count'], 'wire':", ".join(wire)})
+            file.write("};\n")
+
+        file.write("\nstatic const struct freespace_messageInfo messageInfo[FREESPACE_MESSAGE_TYPE_COUNT] = {\n")
+        for message in messages:
+            fields = extractFields(message)
+            flags = []
+            if message.enabled and message.decode:
+                flags.append("FREESPACE_MESSAGE_INFO_DECODE")
+            if message.enabled and message.encode:
+                flags.append("FREESPACE_MESSAGE_INFO_ENCODE")
+            sizes = []
+            for v in range(3):
+                if len(message.ID[v]):
+                    sizes.append(str(message.getMessageSize(v)))
+                else:
+                    sizes.append("0")
+            file.write('''    {"%(name)s", %(enumName)s, sizeof(struct freespace_%(name)s), {%(sizes)s}, %(flags)s, %(count)d, %(fields)s},
+''' % {'name':message.name, 'enumName':message.enumName, 'sizes':", ".join(sizes),
+       'flags':" | ".join(flags) if len(flags) else "0", 'count':len(fields),
+       'fields':"%sFields" % message.structName if len(fields) else "NULL"})
+        file.write('''};
+
+LIBFREESPACE_API const struct freespace_messageInfo* freespace_getMessageInfo(int messageType) {
+    if (messageType < 0 || messageType >= FREESPACE_MESSAGE_TYPE_COUNT) {
+        return NULL;
     }
+    return &messageInfo[messageType];
+}
+''')
+
+    def writeCompactBodies(self, file, messages):
+        if len(messages) > 256:
+            print("ERROR: Too many message types for the compact message header")
+            sys.exit(1)
+        file.write('''
+// Compact messages are a FREESPACE_COMPACT_HEADER_SIZE header followed by
+// the fields of one message, widest first, copied without padding.
+static const uint16_t compactSizes[%d] = {
+''' % len(messages))
+        for message in messages:
+            fields = compactFields(message)
+            sizes = ["sizeof(((struct freespace_%s*) 0)->%s)" % (message.name, f['name']) for f in fields]
+            file.write("    FREESPACE_COMPACT_HEADER_SIZE%s,\n" % "".join([" + " + x for x in sizes]))
+        file.write('''};
+
+LIBFREESPACE_API int freespace_compactSize(int messageType) {
+    if (messageType < 0 || messageType >= (int) (sizeof(compactSizes) / sizeof(compactSizes[0]))) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    return compactSizes[messageType];
+}
 
-    switch (ver) {\n''')
+LIBFREESPACE_API int freespace_compactMessage(const struct freespace_message* message, uint8_t* buf, int maxLength) {
+    uint8_t* p = buf + FREESPACE_COMPACT_HEADER_SIZE;
+    int size = freespace_compactSize(message->messageType);
+
+    if (size < 0) {
+        return size;
+    }
+    if (maxLength < size) {
+        return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+    }
+    buf[0] = (uint8_t) message->messageType;
+    buf[1] = message->ver;
+    buf[2] = message->len;
+    buf[3] = message->dest;
+    buf[4] = message->src;
+
+    switch (message->messageType) {
+''')
+        for message in messages:
+            fields = compactFields(message)
+            file.write("    case %s:\n" % message.enumName)
+            for f in fields:
+                file.write("        memcpy(p, &message->%(s)s.%(f)s, sizeof(message->%(s)s.%(f)s));\n" % {'s':message.structName, 'f':f['name']})
+                file.write("        p += sizeof(message->%s.%s);\n" % (message.structName, f['name']))
+            file.write("        break;\n")
+        file.write('''    default:
+        break;
+    }
+    return size;
+}
+
+LIBFREESPACE_API int freespace_expandMessage(const uint8_t* buf, int length, struct freespace_message* message) {
+    const uint8_t* p = buf + FREESPACE_COMPACT_HEADER_SIZE;
+    int size;
+
+    if (length < FREESPACE_COMPACT_HEADER_SIZE) {
+        return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+    }
+    size = freespace_compactSize(buf[0]);
+    if (size < 0) {
+        return size;
+    }
+    if (length < size) {
+        return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+    }
+    message->messageType = buf[0];
+    message->ver = buf[1];
+    message->len = buf[2];
+    message->dest = buf[3];
+    message->src = buf[4];
+
+    switch (message->messageType) {
+''')
+        for message in messages:
+            fields = compactFields(message)
+            file.write("    case %s:\n" % message.enumName)
+            if len(fields) == 0:
+                file.write("        memset(&message->%s, 0, sizeof(message->%s));\n" % (message.structName, message.structName))
+            for f in fields:
+                file.write("        memcpy(&message->%(s)s.%(f)s, p, sizeof(message->%(s)s.%(f)s));\n" % {'s':message.structName, 'f':f['name']})
+                file.write("        p += sizeof(message->%s.%s);\n" % (message.structName, f['name']))
+            file.write("        break;\n")
+        file.write('''    default:
+        break;
+    }
+    return size;
+}
+''')
+
+    def writeUnionDecodeEncodeBodies(self, file, messages):
         subIdMap = [1, 1, 4] # A lookup table that tells where in the message to find the sub ID. The HID version is the index to the table.
-        for v in range(3):
-            usedIDs = []
-            file.write("\t\tcase %d:\n" % v)
-            file.write("\t\t\tswitch(message[0]) {\n")
+        file.write('''
+typedef int (*freespace_decodeFunction)(const uint8_t* message, int length, struct freespace_message* m, int flags);
+
+// An entry in the decode dispatch tables. Entries for report IDs that are
+// shared by several messages point to a second table indexed by sub ID.
+struct freespace_decodeEntry {
+    freespace_decodeFunction decode;
+    int messageType;
+    const struct freespace_decodeEntry* subIds;
+    int subIdCount;
+};
+
+''')
+        if singleVersion is None:
+            file.write("\nstatic const uint8_t subIdOffsets[%d] = {%s};\n" % (len(subIdMap), ", ".join([str(x) for x in subIdMap])))
+
+        tableNames = []
+        for v in hidVersions():
+            # Messages by report ID, and for report IDs with sub IDs, by sub ID.
+            # When several messages claim the same slot, the first one wins.
+            byId = {}
+            bySubId = {}
             for message in messages:
-                if (not message.decode) or len(message.ID[v]) == 0:
+                if (not message.decode) or (not message.enabled) or len(message.ID[v]) == 0:
                     continue
-                if message.ID[v]['constID'] in usedIDs:
-                    continue
-                file.write("\t\t\t\tcase %d:"%message.ID[v]['constID'])
+                constID = message.ID[v]['constID']
                 if message.ID[v].has_key('subId'):
-                    file.write('''
-                    switch (message[%d]) {''' % subIdMap[v])
-                    for subMessage in messages:
-                        if (not subMessage.decode) or len(subMessage.ID[v]) == 0:
-                            continue
-                        if subMessage.ID[v]['constID'] == message.ID[v]['constID']:
-                            file.write('''
-                        case %(subId)d:
-                            s->messageType = %(messageType)s;
-                            return freespace_decode%(subName)s(message, length, s, ver);'''
-                            %{'subId':subMessage.ID[v]['subId']['id'],
-                           'subName':subMessage.name,
-                           'messageType':subMessage.enumName})                
-            
-                    file.write('''
-                        default:
-                            return FREESPACE_ERROR_MALFORMED_MESSAGE;
-                    }\n''')
+                    subs = bySubId.setdefault(constID, {})
+                    subId = message.ID[v]['subId']['id']
+                    if not subs.has_key(subId):
+                        subs[subId] = message
+                    byId.setdefault(constID, None)
+                elif not byId.has_key(constID):
+                    byId[constID] = message
+
+            for constID in sorted(bySubId.keys()):
+                subs = bySubId[constID]
+                file.write("\nstatic const struct freespace_decodeEntry decodeTableV%d_%d[%d] = {\n" % (v, constID, max(subs.keys()) + 1))
+                for subId in range(max(subs.keys()) + 1):
+                    if subs.has_key(subId):
+                        file.write("    {%s, %s, NULL, 0},\n" % (decodeFunctionName(subs[subId], v), subs[subId].enumName))
+                    else:
+                        file.write("    {NULL, 0, NULL, 0},\n")
+                file.write("};\n")
+
+            file.write("\nstatic const struct freespace_decodeEntry decodeTableV%d[256] = {\n" % v)
+            for constID in range(256):
+                if bySubId.has_key(constID):
+                    file.write("    {NULL, 0, decodeTableV%d_%d, %d},\n" % (v, constID, max(bySubId[constID].keys()) + 1))
+                elif byId.get(constID) is not None:
+                    file.write("    {%s, %s, NULL, 0},\n" % (decodeFunctionName(byId[constID], v), byId[constID].enumName))
                 else:
-                    file.write('''
-                    s->messageType = %(messageType)s;
-                    return freespace_decode%(name)s(message, length, s, ver);
-'''%{'messageType':message.enumName,
-                     'name':message.name})
-                    
-                usedIDs.append(message.ID[v]['constID'])
-            file.write('''                default:
-                    return FREESPACE_ERROR_MALFORMED_MESSAGE;
-            }\n''')
-        file.write('''
-    default:
+                    file.write("    {NULL, 0, NULL, 0},\n")
+            file.write("};\n")
+            tableNames.append("decodeTableV%d" % v)
+
+        # Find the table entry for a report, shared by freespace_decode_message
+        # and freespace_peekMessageType.
+        if singleVersion is not None:
+            file.write('''
+static int findDecodeEntry(const uint8_t* message, int length, uint8_t ver, const struct freespace_decodeEntry** found) {
+    const struct freespace_decodeEntry* entry;
+
+    if (ver != %(v)d) {
         return FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;
     }
+
+    entry = &decodeTableV%(v)d[(uint8_t) message[0]];
+    if (entry->subIds != NULL) {
+        uint8_t subId;
+        if (length <= %(offset)d) {
+            // Too short to hold the sub ID, which is a length failure like
+            // any other truncated report.
+            return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+        }
+        subId = (uint8_t) message[%(offset)d];
+        if (subId >= entry->subIdCount) {
+            return FREESPACE_ERROR_MALFORMED_MESSAGE;
+        }
+        entry = &entry->subIds[subId];
+    }
+    if (entry->decode == NULL) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    *found = entry;
+    return FREESPACE_SUCCESS;
+}
+''' % {'v':singleVersion, 'offset':subIdMap[singleVersion]})
+        else:
+            file.write('''
+static const struct freespace_decodeEntry* const decodeTables[%(count)d] = {%(tables)s};
+
+static int findDecodeEntry(const uint8_t* message, int length, uint8_t ver, const struct freespace_decodeEntry** found) {
+    const struct freespace_decodeEntry* entry;
+
+    if (ver >= %(count)d) {
+        return FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;
+    }
+
+    entry = &decodeTables[ver][(uint8_t) message[0]];
+    if (entry->subIds != NULL) {
+        uint8_t subId;
+        if (length <= subIdOffsets[ver]) {
+            // Too short to hold the sub ID, which is a length failure like
+            // any other truncated report.
+            return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+        }
+        subId = (uint8_t) message[subIdOffsets[ver]];
+        if (subId >= entry->subIdCount) {
+            return FREESPACE_ERROR_MALFORMED_MESSAGE;
+        }
+        entry = &entry->subIds[subId];
+    }
+    if (entry->decode == NULL) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    *found = entry;
+    return FREESPACE_SUCCESS;
+}
+''' % {'count':len(tableNames), 'tables':", ".join(tableNames)})
+
+        file.write('''
+LIBFREESPACE_API int freespace_decode_message(const uint8_t* message, int length, struct freespace_message* s, uint8_t ver) {
+    return freespace_decode_messageEx(message, length, s, ver, 0);
+}
+
+LIBFREESPACE_API int freespace_decode_messageEx(const uint8_t* message, int length, struct freespace_message* s, uint8_t ver, int flags) {
+    const struct freespace_decodeEntry* entry;
+    int rc;
+
+    if (length == 0) {
+        return -1;
+    }
+    rc = findDecodeEntry(message, length, ver, &entry);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    s->messageType = entry->messageType;
+    return entry->decode(message, length, s, flags);
+}
+
+LIBFREESPACE_API int freespace_peekMessageType(const uint8_t* message, int length, uint8_t ver) {
+    const struct freespace_decodeEntry* entry;
+    int rc;
+
+    if (length <= 0) {
+        return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+    rc = findDecodeEntry(message, length, ver, &entry);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+    return entry->messageType;
 }
 ''')
-        
+
+        file.write('''
+LIBFREESPACE_API int freespace_decode_batch(int messageType, const uint8_t* reports, int stride, int count, uint8_t ver, void* columns) {
+    switch (messageType) {''')
+        for message in messages:
+            if (not message.decode) or (not message.enabled):
+                continue
+            file.write('''
+        case %(enumName)s:
+            return freespace_decodeBatch%(name)s(reports, stride, count, ver, (struct freespace_%(name)sColumns*) columns);''' % {'enumName':message.enumName, 'name':message.name})
+        file.write('''
+        default:
+            return FREESPACE_ERROR_MALFORMED_MESSAGE;
+    }
+}
+''')
+
         file.write('''
 LIBFREESPACE_API int freespace_encode_message(struct freespace_message* message, uint8_t* msgBuf, int maxlength) {
     message->src = 0; // Force source to 0, since this is coming from the system host.
     switch (message->messageType) {''')
         for message in messages:
-            if (not message.encode):
+            if (not message.encode) or (not message.enabled):
                 continue
             file.write('''
         case %(enumName)s:
@@ -434,6 +1148,9 @@ def writeCodecHeader(message, fields, outHeader):
     if message.decode:
         writeDecodeDecl(message, outHeader)
         outHeader.write('\n')
+        writeBatchDecodeDecl(message, fields, outHeader)
+        outHeader.write('\n')
+        writeSynthesizeDecls(message, outHeader)
     # Encode function declaration
     if message.encode:
         writeEncodeDecl(message, outHeader)
@@ -444,11 +1161,350 @@ def writeCodecCFile(message, fields, outFile):
     if message.decode:
         writeDecodeBody(message, fields, outFile)
         outFile.write('\n')
+        writeBatchDecodeBody(message, fields, outFile)
+        outFile.write('\n')
+        writeSynthesizeBodies(message, outFile)
 
     if message.encode:
         writeEncodeBody(message, fields, outFile)
         outFile.write('\n')
 
+# --------------------------  C++ Message Layer ------------------------------------
+
+def writeCppHeader(messages, outHeader):
+    writeCopyright(outHeader)
+    outHeader.write('''
+#ifndef FREESPACE_CODECS_HPP_
+#define FREESPACE_CODECS_HPP_
+
+#include "freespace/freespace_codecs.h"
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @defgroup cpp C++ Messages
+ *
+ * A header only C++ layer over the message structs. Each message is a struct
+ * deriving from its C struct, and freespace::Wire<Message, Ver> holds its
+ * constexpr wire layout for one HID protocol version. freespace::decode and
+ * freespace::encode are templated on both, so every offset is a constant and
+ * the codecs inline into the caller.
+ */
+
+namespace freespace {
+
+/** @ingroup cpp
+ * The wire layout and codecs of Message in HID protocol version Ver. It is
+ * only specialized for the versions the message is defined in.
+ */
+template <typename Message, int Ver> struct Wire;
+
+/** @ingroup cpp
+ * Decode a report received from a device.
+ *
+ * @param flags a combination of FREESPACE_DECODE_* flags, or 0
+ * @return FREESPACE_SUCCESS or an error code
+ */
+template <typename Message, int Ver>
+inline int decode(const uint8_t* message, int length, Message& s, int flags = 0) {
+    return Wire<Message, Ver>::decode(message, length, s, flags);
+}
+
+/** @ingroup cpp
+ * Encode a message into a report to send to a device.
+ *
+ * @return the length of the report or an error code
+ */
+template <typename Message, int Ver>
+inline int encode(const Message& s, uint8_t* message, int maxLength, uint8_t dest = 0, uint8_t src = 0) {
+    return Wire<Message, Ver>::encode(s, message, maxLength, dest, src);
+}
+''')
+    for message in messages:
+        if not message.enabled:
+            continue
+        outHeader.write('''
+struct %(name)s : public freespace_%(name)s {
+    static constexpr int messageType = %(enumName)s;
+};
+''' % {'name':message.name, 'enumName':message.enumName})
+        for v in range(3):
+            if len(message.ID[v]) == 0:
+                continue
+            writeCppWire(message, v, outHeader)
+    writeCppDispatch(messages, outHeader)
+    outHeader.write('''
+} // namespace freespace
+
+#endif // FREESPACE_CODECS_HPP_
+''')
+
+def writeCppDispatch(messages, outHeader):
+    outHeader.write('''
+namespace detail {
+
+// True when handler can be called with a const Message&.
+template <typename Handler, typename Message>
+struct Handles {
+    template <typename H, typename = decltype(std::declval<H&>()(std::declval<const Message&>()))>
+    static char test(int);
+    template <typename H>
+    static long test(...);
+    static constexpr bool value = sizeof(test<Handler>(0)) == 1;
+};
+
+template <typename Message, int Ver, typename Handler>
+inline int route(const uint8_t* message, int length, Handler&& handler, std::true_type) {
+    Message s = Message();
+    int rc = Wire<Message, Ver>::decode(message, length, s);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+    handler(static_cast<const Message&>(s));
+    return 1;
+}
+
+template <typename Message, int Ver, typename Handler>
+inline int route(const uint8_t*, int, Handler&&, std::false_type) {
+    return 0;
+}
+
+template <typename Message, int Ver, typename Handler>
+inline int route(const uint8_t* message, int length, Handler&& handler) {
+    return route<Message, Ver>(message, length, std::forward<Handler>(handler),
+                               std::integral_constant<bool, Handles<typename std::remove_reference<Handler>::type, Message>::value>());
+}
+
+} // namespace detail
+
+/** @ingroup cpp
+ * Routes received reports of HID protocol version Ver to a handler.
+ */
+template <int Ver> struct Dispatch;
+''')
+    for v in hidVersions():
+        # Same slot assignment as the decode tables in freespace_decode_message.
+        byId = {}
+        bySubId = {}
+        for message in messages:
+            if (not message.decode) or (not message.enabled) or len(message.ID[v]) == 0:
+                continue
+            constID = message.ID[v]['constID']
+            if message.ID[v].has_key('subId'):
+                subs = bySubId.setdefault(constID, {})
+                subId = message.ID[v]['subId']['id']
+                if not subs.has_key(subId):
+                    subs[subId] = message
+                byId.setdefault(constID, None)
+            elif not byId.has_key(constID):
+                byId[constID] = message
+        outHeader.write('''
+template <> struct Dispatch<%(v)d> {
+    template <typename Handler>
+    static int route(const uint8_t* message, int length, Handler&& handler) {
+        if (length < 1) {
+            return FREESPACE_ERROR_MALFORMED_MESSAGE;
+        }
+        switch (message[0]) {
+''' % {'v':v})
+        for constID in sorted(byId.keys()):
+            outHeader.write("        case %d:\n" % constID)
+            if bySubId.has_key(constID):
+                outHeader.write('''            if (length <= %d) {
+                return FREESPACE_ERROR_MALFORMED_MESSAGE;
+            }
+            switch (message[%d]) {
+''' % (4 if v == 2 else 1, 4 if v == 2 else 1))
+                subs = bySubId[constID]
+                for subId in sorted(subs.keys()):
+                    outHeader.write("                case %d:\n                    return detail::route<%s, %d>(message, length, std::forward<Handler>(handler));\n" % (subId, subs[subId].name, v))
+                outHeader.write('''                default:
+                    return 0;
+            }
+''')
+            else:
+                outHeader.write("            return detail::route<%s, %d>(message, length, std::forward<Handler>(handler));\n" % (byId[constID].name, v))
+        outHeader.write('''        default:
+            return 0;
+        }
+    }
+};
+''')
+
+    outHeader.write('''
+/** @ingroup cpp
+ * Decode a received report and pass it to the handler overload for its
+ * message type. Only message types the handler accepts, as const Message&,
+ * are decoded. Reports of every other type are dropped undecoded.
+ *
+ * @param message the received report
+ * @param length the length of the report
+ * @param handler a callable with one overload per handled message type, such as
+ *        the result of overload(). Temporaries are accepted.
+ * @return 1 if the handler was called, 0 if the report was dropped, or an error code
+ */
+template <int Ver, typename Handler>
+inline int dispatch(const uint8_t* message, int length, Handler&& handler) {
+    return Dispatch<Ver>::route(message, length, std::forward<Handler>(handler));
+}
+
+/** @ingroup cpp
+ * dispatch() for a protocol version that is only known at run time.
+ */
+template <typename Handler>
+inline int dispatch(const uint8_t* message, int length, uint8_t ver, Handler&& handler) {
+    switch (ver) {
+''')
+    for v in hidVersions():
+        outHeader.write("        case %d:\n            return Dispatch<%d>::route(message, length, std::forward<Handler>(handler));\n" % (v, v))
+    outHeader.write('''        default:
+            return FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;
+    }
+}
+
+/** @ingroup cpp
+ * Combines several callables, such as lambdas, into one handler for
+ * dispatch(). Build one with overload().
+ */
+template <typename... Fs> struct Overload;
+
+template <typename F>
+struct Overload<F> : F {
+    Overload(F f) : F(f) {}
+    using F::operator();
+};
+
+template <typename F, typename... Fs>
+struct Overload<F, Fs...> : F, Overload<Fs...> {
+    Overload(F f, Fs... fs) : F(f), Overload<Fs...>(fs...) {}
+    using F::operator();
+    using Overload<Fs...>::operator();
+};
+
+template <typename... Fs>
+inline Overload<Fs...> overload(Fs... fs) {
+    return Overload<Fs...>(fs...);
+}
+''')
+
+def writeCppWire(message, v, outHeader):
+    layout = messageLayout(message, v)
+    size = message.getMessageSize(v)
+    subIdOffset = -1
+    subId = -1
+    if message.ID[v].has_key('subId'):
+        subIdOffset = 4 if v == 2 else 1
+        subId = message.ID[v]['subId']['id']
+    outHeader.write('''
+template <> struct Wire<%(name)s, %(v)d> {
+    static constexpr int size = %(size)d;
+    static constexpr int reportId = %(reportId)d;
+    static constexpr int subIdOffset = %(subIdOffset)d;
+    static constexpr int subId = %(subId)d;
+''' % {'name':message.name, 'v':v, 'size':size, 'reportId':message.ID[v]['constID'],
+       'subIdOffset':subIdOffset, 'subId':subId})
+    for item in layout:
+        outHeader.write("    static constexpr int %sOffset = %d;\n" % (item['name'], item['offset']))
+        if item['kind'] != 'int':
+            outHeader.write("    static constexpr int %sShift = %d;\n" % (item['name'], item['shift']))
+            outHeader.write("    static constexpr int %sMask = 0x%02X;\n" % (item['name'], item['mask']))
+
+    if message.decode:
+        conds = ["(uint8_t) message[0] != reportId"]
+        if subId >= 0:
+            conds.append("(uint8_t) message[subIdOffset] != subId")
+        outHeader.write('''
+    static int decode(const uint8_t* message, int length, %(name)s& s, int flags = 0) {
+        if (length < size) {
+            return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+        }
+        if (%(conds)s) {
+            return FREESPACE_ERROR_MALFORMED_MESSAGE;
+        }
+''' % {'name':message.name, 'conds':" || ".join(conds)})
+        for item in layout:
+            if item['kind'] == 'int' and item['count'] != 1:
+                for j in range(item['count']):
+                    outHeader.write("        s.%s[%d] = %s;\n" % (item['name'], j, viewReadExpr(item['cType'], item['width'], item['offset'] + j * item['width'])))
+            elif item['kind'] == 'int':
+                outHeader.write("        s.%s = %s;\n" % (item['name'], viewReadExpr(item['cType'], item['width'], item['offset'])))
+            else:
+                outHeader.write("        s.%s = (%s) ((message[%d] >> %d) & 0x%02X);\n" % (item['name'], item['cType'], item['offset'], item['shift'], item['mask']))
+        for field in message.Fields[v]:
+            if field.has_key('synthesized'):
+                outHeader.write('''        if ((flags & FREESPACE_DECODE_SKIP_SYNTHESIZED) == 0) {
+            s.%(field)s = %(func)s(&s);
+        } else {
+            s.%(field)s = 0;
+        }
+''' % {'field':field['name'], 'func':synthesizeFunctionName(message, field)})
+        if len(layout) == 0 and len(synthesizedFields(message)) == 0:
+            outHeader.write("        (void) s;\n")
+        outHeader.write('''        return FREESPACE_SUCCESS;
+    }
+''')
+
+    if message.encode:
+        outHeader.write('''
+    static int encode(const %(name)s& s, uint8_t* message, int maxLength, uint8_t dest, uint8_t src) {
+        if (maxLength < size) {
+            return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+        }
+        memset(message, 0, size);
+        message[0] = (uint8_t) reportId;
+''' % {'name':message.name})
+        if v == 2:
+            outHeader.write('''        message[1] = (uint8_t) size;
+        message[2] = dest;
+        message[3] = src;
+''')
+        else:
+            outHeader.write('''        (void) dest;
+        (void) src;
+''')
+        if subId >= 0:
+            outHeader.write("        message[subIdOffset] = (uint8_t) subId;\n")
+        if len(layout) == 0:
+            outHeader.write("        (void) s;\n")
+        bits = {}
+        order = []
+        for item in layout:
+            if item['kind'] == 'int':
+                for e in range(item['count']):
+                    element = "s.%s[%d]" % (item['name'], e) if item['count'] != 1 else "s.%s" % item['name']
+                    for j in range(item['width']):
+                        offset = item['offset'] + e * item['width'] + j
+                        if j == 0:
+                            outHeader.write("        message[%d] = (uint8_t) %s;\n" % (offset, element))
+                        else:
+                            outHeader.write("        message[%d] = (uint8_t) (%s >> %d);\n" % (offset, element, 8 * j))
+            else:
+                if not bits.has_key(item['offset']):
+                    bits[item['offset']] = []
+                    order.append(item['offset'])
+                bits[item['offset']].append("((s.%s & 0x%02X) << %d)" % (item['name'], item['mask'], item['shift']))
+        for offset in order:
+            outHeader.write("        message[%d] = (uint8_t) (%s);\n" % (offset, " | ".join(bits[offset])))
+        outHeader.write('''        return size;
+    }
+''')
+    outHeader.write("};\n")
+
+# The struct fields of a message in compact order: widest first, so that the
+# packed fields stay naturally aligned relative to the start of the payload.
+def compactFields(message):
+    def width(field):
+        if field['type'] in ('uint32_t', 'int32_t', 'int'):
+            return 4
+        if field['type'] in ('uint16_t', 'int16_t'):
+            return 2
+        return 1
+    fields = extractFields(message)
+    order = range(len(fields))
+    order.sort(key=lambda i: (-width(fields[i]), i))
+    return [fields[i] for i in order]
+
 def writeStruct(message, fields, outHeader):
     outHeader.write("\n")
     if message.Documentation != None:
@@ -593,6 +1649,100 @@ def writeDecodeDecl(message, outHeader):
 LIBFREESPACE_API int freespace_decode%(name)s(const uint8_t* message, int length, struct freespace_message* m, uint8_t ver);
 '''%{'name':message.name})
 
+def writeBatchDecodeDecl(message, fields, outHeader):
+    writeColumnsStruct(message, fields, outHeader)
+    outHeader.write('''
+/** @ingroup messages
+ * Decode a batch of %(name)s reports into columns.
+ *
+ * @param reports count reports, stride bytes apart
+ * @param stride the distance between the start of consecutive reports
+ * @param count the number of reports
+ * @param ver the protocol version to use for the reports
+ * @param c the columns to decode into
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_decodeBatch%(name)s(const uint8_t* reports, int stride, int count, uint8_t ver, struct freespace_%(name)sColumns* c);
+''' % {'name':message.name})
+
+def writeColumnsStruct(message, fields, outHeader):
+    outHeader.write('''
+/** @ingroup messages
+ * Column arrays for freespace_decodeBatch%(name)s(). Each non-NULL member
+ * receives one element per report, or for array fields, one run of
+ * elements per report. NULL members are skipped.
+ */
+struct freespace_%(name)sColumns {
+''' % {'name':message.name})
+    if len(fields) > 0:
+        for field in fields:
+            if field['count'] != 1:
+                outHeader.write("\t%s* %s; /**< %d elements per report */\n" % (field['type'], field['name'], field['count']))
+            else:
+                outHeader.write("\t%s* %s;\n" % (field['type'], field['name']))
+    else:
+        outHeader.write("\tuint8_t* nothing; // This is here to keep the compiler happy.\n")
+    outHeader.write("};\n")
+
+def writeBatchDecodeBody(message, fields, outFile):
+    outFile.write('''LIBFREESPACE_API int freespace_decodeBatch%(name)s(const uint8_t* reports, int stride, int count, uint8_t ver, struct freespace_%(name)sColumns* c) {
+    int i;
+
+    if (count < 0) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+''' % {'name':message.name})
+    writeVersionSwitch("ver", "    ", outFile)
+    for v in range(3):
+        if len(message.ID[v]) == 0:
+            continue
+        layout = messageLayout(message, v)
+        writeVersionCase(v, "        ", outFile)
+        outFile.write('''            if (stride < %(size)d) {
+                return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+            }
+            for (i = 0; i < count; i++) {
+                const uint8_t* r = reports + i * stride;
+''' % {'v':v, 'size':message.getMessageSize(v)})
+        conds = ["(uint8_t) r[0] != %d" % message.ID[v]['constID']]
+        if message.ID[v].has_key('subId'):
+            conds.append("(uint8_t) r[%d] != %d" % (4 if v == 2 else 1, message.ID[v]['subId']['id']))
+        outFile.write('''                if (%s) {
+                    return FREESPACE_ERROR_MALFORMED_MESSAGE;
+                }
+            }
+''' % " || ".join(conds))
+        # One loop per field so that each column is written contiguously.
+        for item in layout:
+            outFile.write("            if (c->%s != NULL) {\n" % item['name'])
+            if item['kind'] == 'int' and item['count'] != 1:
+                outFile.write('''                int j;
+                for (i = 0; i < count; i++) {
+                    for (j = 0; j < %(count)d; j++) {
+                        c->%(name)s[i * %(count)d + j] = %(conv)s(&reports[i * stride + %(offset)d + j * %(width)d]);
+                    }
+                }
+''' % {'count':item['count'], 'name':item['name'], 'conv':IntConversionHelper(item['cType']),
+       'offset':item['offset'], 'width':item['width']})
+            elif item['kind'] == 'int':
+                outFile.write('''                for (i = 0; i < count; i++) {
+                    c->%s[i] = %s(&reports[i * stride + %d]);
+                }
+''' % (item['name'], IntConversionHelper(item['cType']), item['offset']))
+            else:
+                outFile.write('''                for (i = 0; i < count; i++) {
+                    c->%s[i] = (%s) ((reports[i * stride + %d] >> %d) & 0x%02X);
+                }
+''' % (item['name'], item['cType'], item['offset'], item['shift'], item['mask']))
+            outFile.write("            }\n")
+        for field in message.Fields[v]:
+            if field.has_key('synthesized'):
+                outFile.write(batchSpecialCaseCode(field, layout))
+        outFile.write("            return FREESPACE_SUCCESS;\n")
+    writeVersionSwitchEnd("    ", outFile)
+    outFile.write("}\n")
+
 def writePrintDecl(message, outHeader):
     outHeader.write('''
 /**
@@ -613,6 +1763,135 @@ LIBFREESPACE_API int freespace_print%(name)s(FILE* fp, const struct freespace_%(
 
 '''%{'name':message.name})
     
+# Compute where each field of a message lives in the report for protocol
+# version v. Offsets are from the start of the report.
+def messageLayout(message, v):
+    layout = []
+    if v == 2:
+        byteCounter = 4
+    else:
+        byteCounter = 1
+    if message.ID[v].has_key('subId'):
+        byteCounter += 1
+    for field in message.Fields[v]:
+        if field.has_key('synthesized'):
+            continue
+        if field['name'] == 'RESERVED':
+            byteCounter += field['size']
+            continue
+        if field.has_key('cType'):
+            info = cTypeToTypeInfo(field['cType'], field['size'])
+            layout.append({'name':field['name'], 'kind':'int', 'offset':byteCounter,
+                           'cType':field['cType'], 'width':info['width'], 'count':info['count'],
+                           'signed':info['signed']})
+            byteCounter += info['width'] * info['count']
+        elif field.has_key('bits'):
+            bitCounter = 0
+            for bit in field['bits']:
+                size = bit.get('size', 1)
+                if bit['name'] != 'RESERVED':
+                    layout.append({'name':bit['name'], 'kind':'bits', 'offset':byteCounter,
+                                   'cType':bitToTypeInfo(bit)['type'], 'shift':bitCounter, 'mask':2**size-1})
+                bitCounter += size
+            byteCounter += 1
+        elif field.has_key('nibbles'):
+            nibbleCounter = 0
+            for nibble in field['nibbles']:
+                if nibble['name'] != 'RESERVED':
+                    layout.append({'name':nibble['name'], 'kind':'bits', 'offset':byteCounter,
+                                   'cType':'int', 'shift':4 * nibbleCounter, 'mask':0x0F})
+                nibbleCounter += 1
+            byteCounter += 1
+    return layout
+
+# An expression that reads a little endian integer at message[offset], where
+# offset is either a constant or a C expression.
+def viewReadExpr(cType, width, offset):
+    parts = []
+    for j in range(width):
+        if isinstance(offset, int):
+            index = "%d" % (offset + j)
+        else:
+            index = "%s + %d" % (offset, j)
+        if j == 0:
+            parts.append("(uint%d_t) message[%s]" % (width * 8, index))
+        else:
+            parts.append("((uint%d_t) message[%s] << %d)" % (width * 8, index, 8 * j))
+    return "(%s) (%s)" % (cType, " | ".join(parts))
+
+def viewVersionChecks(message, v, end, outFile):
+    conds = ["(uint8_t) message[0] != %d" % message.ID[v]['constID']]
+    if message.ID[v].has_key('subId'):
+        conds.append("(uint8_t) message[%d] != %d" % (4 if v == 2 else 1, message.ID[v]['subId']['id']))
+    outFile.write('''            if (length < %s) {
+                return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+            }
+            if (%s) {
+                return FREESPACE_ERROR_MALFORMED_MESSAGE;
+            }
+''' % (end, " || ".join(conds)))
+
+def writeViews(message, outHeader):
+    layouts = {}
+    names = []
+    for v in range(3):
+        if len(message.ID[v]):
+            for item in messageLayout(message, v):
+                if not layouts.has_key(item['name']):
+                    layouts[item['name']] = {}
+                    names.append(item)
+                layouts[item['name']][v] = item
+
+    for first in names:
+        name = first['name']
+        fmt = {'message':message.name, 'field':name, 'type':first['cType']}
+        array = first['kind'] == 'int' and first['count'] != 1
+        if array and first['width'] == 1:
+            # Byte arrays are lent out in place.
+            outHeader.write('''
+/** @ingroup views
+ * Get a pointer to %(message)s.%(field)s inside a received report.
+ */
+FREESPACE_VIEW_INLINE int freespace_view_%(message)s_%(field)s(const uint8_t* message, int length, uint8_t ver, const %(type)s** value) {
+''' % fmt)
+        elif array:
+            outHeader.write('''
+/** @ingroup views
+ * Read element index of %(message)s.%(field)s from a received report.
+ */
+FREESPACE_VIEW_INLINE int freespace_view_%(message)s_%(field)s(const uint8_t* message, int length, uint8_t ver, int index, %(type)s* value) {
+''' % fmt)
+        else:
+            outHeader.write('''
+/** @ingroup views
+ * Read %(message)s.%(field)s from a received report.
+ */
+FREESPACE_VIEW_INLINE int freespace_view_%(message)s_%(field)s(const uint8_t* message, int length, uint8_t ver, %(type)s* value) {
+''' % fmt)
+        writeVersionSwitch("ver", "    ", outHeader)
+        for v in sorted(layouts[name].keys()):
+            item = layouts[name][v]
+            writeVersionCase(v, "        ", outHeader)
+            if array and item['width'] != 1:
+                outHeader.write('''            if (index < 0 || index >= %d) {
+                return FREESPACE_ERROR_UNEXPECTED;
+            }
+''' % item['count'])
+                viewVersionChecks(message, v, "%d + index * %d" % (item['offset'] + item['width'], item['width']), outHeader)
+                outHeader.write("            *value = %s;\n" % viewReadExpr(first['cType'], item['width'], "%d + index * %d" % (item['offset'], item['width'])))
+            elif array:
+                viewVersionChecks(message, v, str(item['offset'] + item['count']), outHeader)
+                outHeader.write("            *value = (const %s*) &message[%d];\n" % (first['cType'], item['offset']))
+            elif item['kind'] == 'int':
+                viewVersionChecks(message, v, str(item['offset'] + item['width']), outHeader)
+                outHeader.write("            *value = %s;\n" % viewReadExpr(first['cType'], item['width'], item['offset']))
+            else:
+                viewVersionChecks(message, v, str(item['offset'] + 1), outHeader)
+                outHeader.write("            *value = (%s) ((message[%d] >> %d) & 0x%02X);\n" % (first['cType'], item['offset'], item['shift'], item['mask']))
+            outHeader.write("            return FREESPACE_SUCCESS;\n")
+        writeVersionSwitchEnd("    ", outHeader)
+        outHeader.write("}\n")
+
 def writeEncodeBody(message, fields, outFile):
     
     outFile.write("LIBFREESPACE_API int freespace_encode%s(const struct freespace_message* m, uint8_t* message, int maxlength) {\n"%message.name)
@@ -623,12 +1902,12 @@ def writeEncodeBody(message, fields, outFile):
         outFile.write("\tconst struct freespace_%s* s = &(m->%s);\n\n"%(message.name, message.structName))
     
     # Encode switch statement
-    outFile.write("\tswitch(m->ver) {\n")
+    writeVersionSwitch("m->ver", "\t", outFile)
     for v in range(3):
         byteCounter = 0
         if len(message.ID[v]):
             # Create one case per version of message
-            outFile.write("\t\tcase %d:\n"%v)
+            writeVersionCase(v, "\t\t", outFile)
             # Check message buffer length
             outFile.write("\t\t\tif (maxlength < %d) {\n"%message.getMessageSize(v))
             outFile.write('\t\t\t\tCODECS_PRINTF("freespace_%s encode(<INVALID LENGTH>)\\n");\n'%message.name)
@@ -695,97 +1974,152 @@ def writeEncodeBody(message, fields, outFile):
             if v == 2:
                 outFile.write("\t\t\tmessage[1] = %d + offset;\n" % byteCounter)
             outFile.write("\t\t\treturn %d + offset;\n" % byteCounter)
-    # Default case
-    outFile.write("\t\tdefault:\n")
-    outFile.write("\t\t\treturn  FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;\n")
-    outFile.write("\t}")
+    writeVersionSwitchEnd("\t", outFile, False)
         
     # End of function
     outFile.write('\r}\n')
 
+def hidVersions():
+    if singleVersion is not None:
+        return [singleVersion]
+    return range(3)
+
+# Drop every other protocol version from the messages. This runs after the
+# messages are sorted, so the MessageTypes values are the same in every build.
+# Messages that do not exist in the version get no codecs at all.
+def restrictVersion(messages, v):
+    for message in messages:
+        if len(message.ID[v]) == 0:
+            message.enabled = False
+        for other in range(3):
+            if other != v:
+                message.ID[other] = {}
+
+# The cases of a switch on the protocol version. When only one version is
+# generated, the switch becomes a single check ahead of a plain block.
+def writeVersionSwitch(expr, indent, outFile):
+    if singleVersion is None:
+        outFile.write("%sswitch (%s) {\n" % (indent, expr))
+    else:
+        step = "\t" if indent.startswith("\t") else "    "
+        outFile.write("%(i)sif (%(e)s != %(v)d) {\n%(i)s%(s)sreturn FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;\n%(i)s}\n%(i)s{\n" % {'i':indent, 's':step, 'e':expr, 'v':singleVersion})
+
+def writeVersionCase(v, indent, outFile):
+    if singleVersion is None:
+        outFile.write("%scase %d:\n" % (indent, v))
+
+def writeVersionSwitchEnd(indent, outFile, newline = True):
+    step = "\t" if indent.startswith("\t") else "    "
+    if singleVersion is None:
+        outFile.write("%sdefault:\n%sreturn FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;\n" % (indent + step, indent + step * 2))
+    outFile.write(indent + "}")
+    if newline:
+        outFile.write("\n")
+
+def decodeFunctionName(message, v):
+    return "decode%s_v%d" % (message.name, v)
+
 def writeDecodeBody(message, fields, outFile):
-    outFile.write("LIBFREESPACE_API int freespace_decode%s(const uint8_t* message, int length, struct freespace_message* m, uint8_t ver) {" %message.name)
-    outFile.write("\n\tuint8_t offset = 1;\n")
-    if len(fields) > 0:
-        outFile.write("\tstruct freespace_%s* s = &(m->%s);\n\n"%(message.name, message.structName))
-    outFile.write("\tm->ver = ver;\n\n")
-    # Encode switch statement
-    outFile.write("\tswitch(ver) {\n")
-    byteCounter = 0
+    # One decoder per protocol version. These are only reached once the
+    # report ID and sub ID are known to match, either through the dispatch
+    # tables in freespace_decode_message or the checks in the wrapper below.
     for v in range(3):
         if len(message.ID[v]):
-            # Create one case per version of message
-            byteCounter = 0
-            outFile.write("\t\tcase %d:\n"%v)
-            # Code to check message buffer length and report ID
-            if len(message.ID[v]):
-                outFile.write('''            if ((STRICT_DECODE_LENGTH && length != %(size)d) || (!STRICT_DECODE_LENGTH && length < %(size)d)) {
-                CODECS_PRINTF(\"Length mismatch for %%s.  Expected %%d.  Got %%d.\\n\", \"%(name)s\", %(size)d, length);
-                return FREESPACE_ERROR_BUFFER_TOO_SMALL;
-            }
-            if ((uint8_t) message[0] != %(id)d) {
+            writeVersionDecodeBody(message, fields, v, outFile)
+
+    outFile.write("LIBFREESPACE_API int freespace_decode%s(const uint8_t* message, int length, struct freespace_message* m, uint8_t ver) {\n" %message.name)
+    writeVersionSwitch("ver", "\t", outFile)
+    for v in range(3):
+        if len(message.ID[v]):
+            writeVersionCase(v, "\t\t", outFile)
+            writeDecodeLengthCheck(message, v, outFile)
+            outFile.write('''            if ((uint8_t) message[0] != %d) {
                 return FREESPACE_ERROR_MALFORMED_MESSAGE;
             }
-'''%{'size':message.getMessageSize(v), 'id':message.ID[v]['constID'], 'name':message.name})
-            if v == 2:
-                outFile.write("\t\t\toffset = 4;\n")
-                outFile.write("\t\t\tm->len = message[1];\n")
-                outFile.write("\t\t\tm->dest = message[2];\n")
-                outFile.write("\t\t\tm->src = message[3];\n")
-
+'''%message.ID[v]['constID'])
             if message.ID[v].has_key('subId'):
-                outFile.write('''
-            if ((uint8_t) message[offset] != %d) {
+                outFile.write('''            if ((uint8_t) message[%d] != %d) {
                 return FREESPACE_ERROR_MALFORMED_MESSAGE;
             }
-'''%message.ID[v]['subId']['id'])
-                byteCounter += 1
-            for field in message.Fields[v]:
-                if field.has_key('synthesized'):
-                    continue
-                elementSize = field['size']
-                if field['name'] == 'RESERVED':
-                    byteCounter += elementSize
-                    continue
-                if field.has_key('cType'):
-                    if field['typeDecode']['count'] == 1:
-                        outFile.write("\t\t\ts->%s = %s(&message[%d + offset]);\n" % (field['name'], IntConversionHelper(field['typeDecode']['type']), byteCounter))
-                        byteCounter += field['typeDecode']['width']
-                    else:
-                        for i in range (field['typeDecode']['count']):
-                            outFile.write("\t\t\ts->%s[%d] = %s(&message[%d + offset]);\n" % (field['name'], i, IntConversionHelper(field['typeDecode']['type']), byteCounter))
-                            byteCounter += field['typeDecode']['width']
-                elif field.has_key('bits'):
-                    bitCounter = 0
-                    for bit in field['bits']:
-                        if bit['name'] != 'RESERVED':
-                            if bit.has_key('size'):
-                                outFile.write("\t\t\ts->%s = (uint8_t) ((message[%d + offset] >> %d) & 0x%02X);\n"%(bit['name'], byteCounter, bitCounter, 2**bit['size']-1))
-                                bitCounter += bit['size']-1
-                            else:
-                                outFile.write("\t\t\ts->%s = getBit(message[%d + offset], %d);\n"%(bit['name'], byteCounter, bitCounter))
-                        bitCounter += 1
-                    byteCounter += 1
-                elif field.has_key('nibbles'):
-
-                    nibbleCounter = 0
-                    for nibble in field['nibbles']:
-                        if nibble['name'] != 'RESERVED':
-                            outFile.write('    s->%s = getNibble(message[%d + offset], %d);\n'%(nibble['name'], byteCounter, nibbleCounter))
-                        nibbleCounter += 1
-                    byteCounter += 1
-                else:
-                    print ("Unrecognized field type in %s\n" % message.name)
-            for field in message.Fields[v]:
-                if field.has_key('synthesized'):
-                    outFile.write(specialCaseCode(field['synthesized']))
-            outFile.write("\t\t\treturn FREESPACE_SUCCESS;\n")
-    # Default case
-    outFile.write("\t\tdefault:\n")
-    outFile.write("\t\t\treturn  FREESPACE_ERROR_INVALID_HID_PROTOCOL_VERSION;\n")
-    outFile.write('\t}\n')
+'''%(4 if v == 2 else 1, message.ID[v]['subId']['id']))
+            outFile.write("\t\t\treturn %s(message, length, m, 0);\n" % decodeFunctionName(message, v))
+    writeVersionSwitchEnd("\t", outFile)
     outFile.write('}\n')
 
+def writeDecodeLengthCheck(message, v, outFile, indent = "            "):
+    outFile.write('''%(i)sif ((STRICT_DECODE_LENGTH && length != %(size)d) || (!STRICT_DECODE_LENGTH && length < %(size)d)) {
+%(i)s    CODECS_PRINTF(\"Length mismatch for %%s.  Expected %%d.  Got %%d.\\n\", \"%(name)s\", %(size)d, length);
+%(i)s    return FREESPACE_ERROR_BUFFER_TOO_SMALL;
+%(i)s}
+'''%{'size':message.getMessageSize(v), 'name':message.name, 'i':indent})
+
+def writeVersionDecodeBody(message, fields, v, outFile):
+    outFile.write("static int %s(const uint8_t* message, int length, struct freespace_message* m, int flags) {\n" % decodeFunctionName(message, v))
+    if len(fields) > 0:
+        outFile.write("\tstruct freespace_%s* s = &(m->%s);\n"%(message.name, message.structName))
+    if len(messageLayout(message, v)) == 0:
+        outFile.write("\n")
+    elif v == 2:
+        outFile.write("\tconst int offset = 4;\n\n")
+    else:
+        outFile.write("\tconst int offset = 1;\n\n")
+    byteCounter = 0
+    writeDecodeLengthCheck(message, v, outFile, "\t")
+    outFile.write("\tm->ver = %d;\n" % v)
+    if v == 2:
+        outFile.write("\tm->len = message[1];\n")
+        outFile.write("\tm->dest = message[2];\n")
+        outFile.write("\tm->src = message[3];\n")
+
+    if message.ID[v].has_key('subId'):
+        byteCounter += 1
+    for field in message.Fields[v]:
+        if field.has_key('synthesized'):
+            continue
+        elementSize = field['size']
+        if field['name'] == 'RESERVED':
+            byteCounter += elementSize
+            continue
+        if field.has_key('cType'):
+            if field['typeDecode']['count'] == 1:
+                outFile.write("\ts->%s = %s(&message[%d + offset]);\n" % (field['name'], IntConversionHelper(field['typeDecode']['type']), byteCounter))
+                byteCounter += field['typeDecode']['width']
+            else:
+                for i in range (field['typeDecode']['count']):
+                    outFile.write("\ts->%s[%d] = %s(&message[%d + offset]);\n" % (field['name'], i, IntConversionHelper(field['typeDecode']['type']), byteCounter))
+                    byteCounter += field['typeDecode']['width']
+        elif field.has_key('bits'):
+            bitCounter = 0
+            for bit in field['bits']:
+                if bit['name'] != 'RESERVED':
+                    if bit.has_key('size'):
+                        outFile.write("\ts->%s = (uint8_t) ((message[%d + offset] >> %d) & 0x%02X);\n"%(bit['name'], byteCounter, bitCounter, 2**bit['size']-1))
+                        bitCounter += bit['size']-1
+                    else:
+                        outFile.write("\ts->%s = getBit(message[%d + offset], %d);\n"%(bit['name'], byteCounter, bitCounter))
+                bitCounter += 1
+            byteCounter += 1
+        elif field.has_key('nibbles'):
+
+            nibbleCounter = 0
+            for nibble in field['nibbles']:
+                if nibble['name'] != 'RESERVED':
+                    outFile.write('\ts->%s = getNibble(message[%d + offset], %d);\n'%(nibble['name'], byteCounter, nibbleCounter))
+                nibbleCounter += 1
+            byteCounter += 1
+        else:
+            print ("Unrecognized field type in %s\n" % message.name)
+    for field in message.Fields[v]:
+        if field.has_key('synthesized'):
+            outFile.write('''	if ((flags & FREESPACE_DECODE_SKIP_SYNTHESIZED) == 0) {
+		s->%(name)s = %(expr)s;
+	} else {
+		s->%(name)s = 0;
+	}
+''' % {'name':field['name'], 'expr':specialCaseCode(field['synthesized'], 's->')})
+    outFile.write("\n\treturn FREESPACE_SUCCESS;\n")
+    outFile.write('}\n\n')
+
 def printStrHelper(message, outFile):
     fields = extractFields(message)
     first = True
@@ -898,16 +2232,85 @@ def writeCloseExternC(outHeader):
     outHeader.write('#endif\n')
 
 #----------------------- Special Case Code ----------------------------
-def specialCaseCode(case):
+# The expression that computes a synthesized field from the other fields of
+# a decoded struct, accessed through prefix.
+def specialCaseCode(case, prefix):
     if case == 'case_A':
         # Calculate the A value of the quaternion
         # A = sqrt(16384**2 - (B**2 + C**2 + D**2))
-        specialCode = "\t\t\ts->angularPosA = (int16_t) sqrt(268435456 - ((s->angularPosB * s->angularPosB) + (s->angularPosC * s->angularPosC) + (s->angularPosD * s->angularPosD)));\n"
+        specialCode = "synthesizeQuaternionA(%(p)sangularPosB, %(p)sangularPosC, %(p)sangularPosD)" % {'p':prefix}
     else:
         print ("Unrecognized special case: %s" % case)
         specialCode =  "Unknown code goes here."
         
     return specialCode
+
+# The synthesized fields of a message across all versions, without repeats
+def synthesizedFields(message):
+    found = []
+    names = []
+    for v in range(3):
+        for field in message.Fields[v]:
+            if field.has_key('synthesized') and field['name'] not in names:
+                names.append(field['name'])
+                found.append(field)
+    return found
+
+def synthesizeFunctionName(message, field):
+    return "freespace_synthesize%s%s" % (message.name, field['name'][0].upper() + field['name'][1:])
+
+def writeSynthesizeDecls(message, outHeader):
+    for field in synthesizedFields(message):
+        outHeader.write('''/** @ingroup messages
+ * Compute %(message)s.%(field)s from the other fields of a decoded message.
+ * Use this when decoding with FREESPACE_DECODE_SKIP_SYNTHESIZED.
+ *
+ * @param s the decoded message
+ * @return the value %(field)s would have been decoded with
+ */
+LIBFREESPACE_API %(type)s %(func)s(const struct freespace_%(message)s* s);
+
+''' % {'message':message.name, 'field':field['name'], 'type':field['cType'], 'func':synthesizeFunctionName(message, field)})
+
+def writeSynthesizeBodies(message, outFile):
+    for field in synthesizedFields(message):
+        outFile.write('''LIBFREESPACE_API %(type)s %(func)s(const struct freespace_%(message)s* s) {
+    return %(expr)s;
+}
+
+''' % {'message':message.name, 'type':field['cType'], 'func':synthesizeFunctionName(message, field),
+       'expr':specialCaseCode(field['synthesized'], 's->')})
+def batchSpecialCaseCode(field, layout):
+    offsets = dict([(item['name'], item['offset']) for item in layout])
+    if field['synthesized'] == 'case_A':
+        return '''            if (c->%(name)s != NULL) {
+                for (i = 0; i < count; i++) {
+                    const uint8_t* r = reports + i * stride;
+                    c->%(name)s[i] = synthesizeQuaternionA(toInt16(&r[%(b)d]), toInt16(&r[%(c)d]), toInt16(&r[%(d)d]));
+                }
+            }
+''' % {'name':field['name'], 'b':offsets['angularPosB'], 'c':offsets['angularPosC'], 'd':offsets['angularPosD']}
+    print ("Unrecognized special case: %s" % field['synthesized'])
+    return "Unknown code goes here."
+
+# Mark which messages the allowlist enables. An entry is either a message name
+# or a HID version such as "v2", which enables every message defined for it.
+def selectMessages(messages, allowlist):
+    entries = [x.strip() for x in allowlist.replace(";", ",").split(",") if len(x.strip())]
+    names = {}
+    for message in messages:
+        names[message.name] = message
+        message.enabled = len(entries) == 0
+    for entry in entries:
+        if entry in ("v0", "v1", "v2"):
+            for message in messages:
+                if len(message.ID[int(entry[1])]):
+                    message.enabled = True
+        elif names.has_key(entry):
+            names[entry].enabled = True
+        else:
+            raise Usage("Unknown message or HID version in allowlist: %s" % entry)
+
 # ---------------------- Main function --------------------------------
 # Courtesy of Guido: http://www.artima.com/weblogs/viewpost.jsp?thread=4829
 class Usage(Exception):
@@ -931,6 +2334,12 @@ def main(argv=None):
                             help="Include directory to write generated freespace headers to")
         parser.add_argument("-s", "--src", default="src",
                             help="Source directory to write generated source files to")
+        parser.add_argument("-m", "--messages", default="",
+                            help="Comma separated allowlist of message names and HID versions (v0, v1, v2) to generate " +
+                                 "codecs and printers for. All other messages keep their structs but nothing else. " +
+                                 "By default all messages are generated")
+        parser.add_argument("-H", "--hid-version", type=int, choices=range(3), default=None,
+                            help="Only generate code for one HID protocol version, without any switching on the version")
         parser.add_argument("messageFiles", nargs="+",
                             help="List of message definition files")
         args = parser.parse_args()
@@ -943,6 +2352,10 @@ def main(argv=None):
             execfile(f, g, d)
             messages.extend(d['messages'])
 
+        selectMessages(messages, args.messages)
+        global singleVersion
+        singleVersion = args.hid_version
+
         includeDir = os.path.join(args.include, "freespace")
         srcDir = args.src
 
@@ -965,6 +2378,8 @@ if __name__ == "__main__":
     __doc__ = "Options\n"
     __doc__ = __doc__ + "\t--h\t--help\tHelp menu\n"
     __doc__ = __doc__ + "\t--t\t--test\tGenerate encoders and decoders for all messages\n"
+    __doc__ = __doc__ + "\t--H\t--hid-version\tOnly generate code for the given HID protocol version\n"
+    __doc__ = __doc__ + "\t--m\t--messages\tOnly generate codecs & printers for the listed messages and HID versions\n"
     __doc__ = __doc__ + "\n"
     __doc__ = __doc__ + "Arguments\n"
     __doc__ = __doc__ + "\t<file>\t*.py\tGenerate codecs & printers for messages in file"
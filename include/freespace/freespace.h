@@ -36,6 +36,14 @@ extern "C" {
 #define FREESPACE_MAX_OUTPUT_MESSAGE_SIZE 96
 #define FREESPACE_MAXIMUM_DEVICE_COUNT 16 // TODO this could be overkill!. down from 128
 #define FREESPACE_RESERVED_ADDRESS 4
+#define FREESPACE_RECEIVE_QUEUE_SIZE_MAX 64
+#define FREESPACE_SEND_PIPELINE_DEPTH_MAX 8
+#define FREESPACE_RECEIVE_BUFFERS_MAX 64
+#define FREESPACE_SUBSCRIBERS_MAX 8
+#define FREESPACE_SUBSCRIBER_QUEUE_MAX 16
+// Enough for every queue slot to hold its own message, plus some to route
+// and to keep with freespace_acquireMessage().
+#define FREESPACE_SHARED_MESSAGES_MAX (FREESPACE_SUBSCRIBERS_MAX * FREESPACE_SUBSCRIBER_QUEUE_MAX + 32)
 
 /**
  * @defgroup initialization Initialization
@@ -90,6 +98,42 @@ struct FreespaceDeviceInfo {
 	int hVer;
 };
 
+/** @ingroup device
+ * Flags for freespace_setReceiveQueueSize().
+ */
+enum freespace_receiveQueueFlags {
+    /** Grow the receive queue, up to FREESPACE_RECEIVE_QUEUE_SIZE_MAX,
+        whenever it fills up, and shrink it back toward the configured
+        size once it has gone a while without filling up. */
+    FREESPACE_RECEIVE_QUEUE_ADAPTIVE = 0x01
+};
+
+/** @ingroup device
+ * Receive statistics returned by freespace_getReceiveStats().
+ */
+struct FreespaceReceiveStats {
+    /** The number of receive transfers currently in use */
+    int queueDepth;
+
+    /** The number of reads that found every receive transfer holding an
+        unread report. Nonzero values mean reports may have been dropped. */
+    uint32_t queueFullCount;
+
+    /** The number of times a receive transfer could not be resubmitted */
+    uint32_t resubmitFailureCount;
+};
+
+/** @ingroup synchronous
+ * A received report lent out by freespace_borrowReport().
+ */
+struct FreespaceReportBuffer {
+    /** The report. Owned by libfreespace until freespace_releaseReport(). */
+    uint8_t* data;
+
+    /** The length of the report */
+    int length;
+};
+
 /** @ingroup discovery
  * Enumeration for the type of hotplug event.
  */
@@ -151,6 +195,39 @@ typedef void (*freespace_receiveMessageCallback)(FreespaceDeviceId id,
                                                  void* cookie,
                                                  int result);
 
+/** @ingroup async
+ * Callback for decoded messages passed to a subscriber. The message is
+ * shared with the other callbacks that receive the same report.
+ *
+ * @param id The device that generated the message
+ * @param message the decoded HID message, or NULL if result is an error
+ * @param cookie the data passed to freespace_subscribe().
+ * @param result FREESPACE_SUCCESS if a packet was received; else error code
+ */
+typedef void (*freespace_subscriberCallback)(FreespaceDeviceId id,
+                                             const struct freespace_message* message,
+                                             void* cookie,
+                                             int result);
+
+/** @ingroup async
+ * A set of message types for freespace_setMessageFilter(), one bit per
+ * MessageTypes value. Clear it with memset and add types with
+ * FREESPACE_MESSAGE_MASK_ADD.
+ */
+struct FreespaceMessageMask {
+    uint32_t bits[(FREESPACE_MESSAGE_TYPE_COUNT + 31) / 32];
+};
+
+/** @ingroup async
+ * Add a MessageTypes value to a struct FreespaceMessageMask.
+ */
+#define FREESPACE_MESSAGE_MASK_ADD(mask, type) ((mask)->bits[(type) / 32] |= (uint32_t) 1 << ((type) % 32))
+
+/** @ingroup async
+ * Nonzero if a struct FreespaceMessageMask contains a MessageTypes value.
+ */
+#define FREESPACE_MESSAGE_MASK_HAS(mask, type) (((mask)->bits[(type) / 32] >> ((type) % 32)) & 1)
+
 /** @ingroup async
  * Callback for when file descriptors should be added to the
  * poll or select fd sets
@@ -323,6 +400,84 @@ LIBFREESPACE_API int freespace_readMessage(FreespaceDeviceId id,
  */
 LIBFREESPACE_API int freespace_flush(FreespaceDeviceId id);
 
+/** @ingroup device
+ *
+ * Set the depth of the receive queue used for the device. Deeper
+ * queues absorb bursts of high-rate reports when they are read
+ * synchronously, while shallower ones use fewer resources for idle
+ * devices. The setting takes effect the next time the device is opened.
+ * Not all platforms have a configurable receive queue.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param size the number of receive transfers, or 0 for the default
+ * @param flags a combination of freespace_receiveQueueFlags
+ * @return FREESPACE_SUCCESS, or FREESPACE_ERROR_UNEXPECTED if size is out
+ *         of range or flags has unknown bits set
+ */
+LIBFREESPACE_API int freespace_setReceiveQueueSize(FreespaceDeviceId id,
+                                                   int size,
+                                                   int flags);
+
+/** @ingroup device
+ *
+ * Get the receive statistics for the device.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param stats where to store the statistics
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_getReceiveStats(FreespaceDeviceId id,
+                                               struct FreespaceReceiveStats* stats);
+
+/** @ingroup synchronous
+ *
+ * Read a report without copying it. The report is left in the buffer it
+ * was received into and lent to the caller, who must pass it to
+ * freespace_releaseReport() once done with it. Several reports may be
+ * lent out at once. When no buffer is free to receive into in place of
+ * the lent one, this returns FREESPACE_ERROR_BUSY.
+ *
+ * @param id the FreespaceDeviceId of the device to read from
+ * @param timeoutMs the number of milliseconds to wait for a report
+ * @param report where to store the lent report
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_borrowReport(FreespaceDeviceId id,
+                                            unsigned int timeoutMs,
+                                            struct FreespaceReportBuffer* report);
+
+/** @ingroup synchronous
+ *
+ * Return a report lent by freespace_borrowReport() so that its buffer
+ * can receive again. All lent reports must be released before the
+ * device is closed.
+ *
+ * @param id the FreespaceDeviceId of the device the report came from
+ * @param report the lent report
+ * @return FREESPACE_SUCCESS, or FREESPACE_ERROR_UNEXPECTED if the report
+ *         is not currently lent out by this device
+ */
+LIBFREESPACE_API int freespace_releaseReport(FreespaceDeviceId id,
+                                             struct FreespaceReportBuffer* report);
+
+/** @ingroup synchronous
+ *
+ * Give the device more buffers to receive into so that more reports
+ * can be lent out by freespace_borrowReport() at once. The buffers
+ * must stay valid until freespace_closeDevice() returns, since a receive
+ * may still be writing into one until the device handle is closed. After
+ * that they are forgotten. Up to FREESPACE_RECEIVE_BUFFERS_MAX buffers may be added
+ * each time the device is opened.
+ *
+ * @param id the FreespaceDeviceId of an open device
+ * @param buffers count consecutive buffers of FREESPACE_MAX_INPUT_MESSAGE_SIZE bytes
+ * @param count the number of buffers
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_addReceiveBuffers(FreespaceDeviceId id,
+                                                 uint8_t* buffers,
+                                                 int count);
+
 /** @ingroup async
  *
  * Register a callback function to handle received HID messages.
@@ -351,6 +506,170 @@ LIBFREESPACE_API int freespace_setReceiveMessageCallback(FreespaceDeviceId id,
                                                          freespace_receiveMessageCallback callback,
                                                          void* cookie);
 
+/** @ingroup async
+ *
+ * Only pass messages of the types in mask to the callback set with
+ * freespace_setReceiveMessageCallback(). Reports of other types are dropped
+ * after their report ID is checked, without being decoded, unless a
+ * callback for their type is registered with freespace_setMessageTypeCallback().
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param mask the message types to receive, or NULL to receive all of them
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_setMessageFilter(FreespaceDeviceId id,
+                                                const struct FreespaceMessageMask* mask);
+
+/** @ingroup async
+ *
+ * Register a callback function for decoded messages of one type. It is
+ * called before the callback set with freespace_setReceiveMessageCallback(),
+ * and regardless of the filter set with freespace_setMessageFilter().
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param messageType the MessageTypes value to receive
+ * @param callback the callback function, or NULL to remove it
+ * @param cookie any user data
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_setMessageTypeCallback(FreespaceDeviceId id,
+                                                      int messageType,
+                                                      freespace_receiveMessageCallback callback,
+                                                      void* cookie);
+
+/** @ingroup async
+ *
+ * Add a subscriber for decoded messages. A device has up to
+ * FREESPACE_SUBSCRIBERS_MAX subscribers, each with its own filter, in
+ * addition to the callback set with freespace_setReceiveMessageCallback().
+ * Each received report is decoded once, and all subscribers that want it
+ * get the same message in the thread that calls freespace_perform(). The
+ * message is only valid during the callback unless it is kept with
+ * freespace_acquireMessage().
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param mask the message types to receive, or NULL to receive all of them
+ * @param callback the callback function
+ * @param cookie any user data
+ * @return the subscription, to pass to freespace_unsubscribe(), or an error
+ */
+LIBFREESPACE_API int freespace_subscribe(FreespaceDeviceId id,
+                                         const struct FreespaceMessageMask* mask,
+                                         freespace_subscriberCallback callback,
+                                         void* cookie);
+
+/** @ingroup async
+ *
+ * Add a subscriber that queues decoded messages instead of receiving them
+ * in a callback. Read them with freespace_popMessage() or
+ * freespace_drainMessages() in the thread that calls freespace_perform().
+ * Only messages that decode successfully are queued. When the queue is
+ * full, the oldest message is dropped to make room. Messages are also
+ * dropped while all FREESPACE_SHARED_MESSAGES_MAX shared messages are
+ * held, which only happens when the application holds many of them.
+ * freespace_getDroppedMessages() counts both.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param mask the message types to receive, or NULL to receive all of them
+ * @param depth the number of messages to hold, up to FREESPACE_SUBSCRIBER_QUEUE_MAX
+ * @return the subscription, to pass to freespace_popMessage() and
+ *         freespace_unsubscribe(), or an error
+ */
+LIBFREESPACE_API int freespace_subscribeQueue(FreespaceDeviceId id,
+                                              const struct FreespaceMessageMask* mask,
+                                              int depth);
+
+/** @ingroup async
+ *
+ * Remove a subscriber added with freespace_subscribe() or
+ * freespace_subscribeQueue(), and drop any messages in its queue. This may
+ * be called from any message callback, including the subscriber's own.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param subscription the value returned by freespace_subscribe()
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_unsubscribe(FreespaceDeviceId id, int subscription);
+
+/** @ingroup async
+ *
+ * Take the oldest message from the queue of a subscriber added with
+ * freespace_subscribeQueue(). The caller holds the message as if it had
+ * called freespace_acquireMessage() and must give it back with
+ * freespace_releaseMessage().
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param subscription the value returned by freespace_subscribeQueue()
+ * @param message where to store the message
+ * @return FREESPACE_SUCCESS, FREESPACE_ERROR_NO_DATA if the queue is empty,
+ *         or an error
+ */
+LIBFREESPACE_API int freespace_popMessage(FreespaceDeviceId id,
+                                          int subscription,
+                                          const struct freespace_message** message);
+
+/** @ingroup async
+ *
+ * Get the number of messages that a subscriber added with
+ * freespace_subscribeQueue() has lost, either because its queue was full
+ * or because no shared message was free to queue.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param subscription the value returned by freespace_subscribeQueue()
+ * @param dropped where to store the count since the subscriber was added
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_getDroppedMessages(FreespaceDeviceId id,
+                                                  int subscription,
+                                                  uint32_t* dropped);
+
+/** @ingroup async
+ *
+ * Pass every message in the queue of a subscriber added with
+ * freespace_subscribeQueue() to callback, oldest first, and release each
+ * one when the callback returns.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param subscription the value returned by freespace_subscribeQueue()
+ * @param callback the callback function
+ * @param cookie any user data
+ * @return the number of messages passed to callback, or an error
+ */
+LIBFREESPACE_API int freespace_drainMessages(FreespaceDeviceId id,
+                                             int subscription,
+                                             freespace_subscriberCallback callback,
+                                             void* cookie);
+
+/** @ingroup async
+ *
+ * Keep a message passed to a subscriber valid after its callback returns.
+ * Messages are reference counted, so every subscriber can hold the same
+ * one. Each call must be matched by a call to freespace_releaseMessage().
+ * A device holds up to FREESPACE_SHARED_MESSAGES_MAX messages at once.
+ * While all of them are held, subscribers are passed messages that can't
+ * be kept.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param message a message passed to a subscriber callback
+ * @return FREESPACE_SUCCESS, FREESPACE_ERROR_BUSY if the message can't be
+ *         kept, or FREESPACE_ERROR_UNEXPECTED if it is not a message
+ *         currently held by the device
+ */
+LIBFREESPACE_API int freespace_acquireMessage(FreespaceDeviceId id,
+                                              const struct freespace_message* message);
+
+/** @ingroup async
+ *
+ * Release a message kept with freespace_acquireMessage() or taken with
+ * freespace_popMessage(). The message must not be used afterwards.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param message the message to release
+ * @return FREESPACE_SUCCESS or FREESPACE_ERROR_UNEXPECTED if the message is not held
+ */
+LIBFREESPACE_API int freespace_releaseMessage(FreespaceDeviceId id,
+                                              const struct freespace_message* message);
+
 /** @ingroup async
  *
  * Send a message to the specified Freespace device, but do not block.
@@ -389,6 +708,40 @@ LIBFREESPACE_API int freespace_sendMessageAsync(FreespaceDeviceId id,
                                                 freespace_sendCallback callback,
                                                 void* cookie);
 
+/** @ingroup async
+ *
+ * Set the number of sends that may be in flight to the device at once.
+ * Sends complete in the order that they were made. When the pipeline is
+ * full, freespace_sendMessageAsync returns FREESPACE_ERROR_BUSY and
+ * freespace_sendMessage waits for room. Not all platforms pipeline sends.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param depth 1 to FREESPACE_SEND_PIPELINE_DEPTH_MAX, or 0 for the maximum
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_setSendPipelineDepth(FreespaceDeviceId id, int depth);
+
+/** @ingroup synchronous
+ *
+ * Set how long freespace_sendMessage waits, including any time spent
+ * waiting for room in the send pipeline.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @param timeoutMs the timeout in milliseconds, or 0 for the default
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_setSendTimeout(FreespaceDeviceId id, unsigned int timeoutMs);
+
+/** @ingroup async
+ *
+ * Cancel all sends in flight to the device. Their callbacks are called
+ * with FREESPACE_ERROR_INTERRUPTED.
+ *
+ * @param id the FreespaceDeviceId of the device
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_cancelSends(FreespaceDeviceId id);
+
 /** @ingroup async
  *
  * Get the next timeout for a call to select or poll.
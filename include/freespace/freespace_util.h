@@ -51,6 +51,26 @@ struct MultiAxisSensor {
     float z;
 };
 
+/** This struct is used to exchange the raw fixed-point values for a sensor.
+ * Each coordinate holds the value as sent by the device. Dividing it by
+ * scale gives the value returned by the matching float function.
+ * Unused coordinates are left untouched, as for MultiAxisSensor.
+ */
+struct MultiAxisSensorRaw {
+    /** W-coordinate */
+    int16_t w;
+    /** X-coordinate */
+    int16_t x;
+    /** Y-coordinate */
+    int16_t y;
+    /** Z-coordinate */
+    int16_t z;
+    /** The divisor that converts the coordinates to the float function's units */
+    int scale;
+    /** The number of fractional bits, i.e. log2(scale), or -1 if scale is not a power of two */
+    int qFormat;
+};
+
 /** @ingroup util
  *
  * Get the acceleration values from a MEOut packet.
@@ -198,6 +218,221 @@ LIBFREESPACE_API int freespace_util_getAngPos(struct freespace_MotionEngineOutpu
 LIBFREESPACE_API int freespace_util_getActClass(struct freespace_MotionEngineOutput const * meOutPkt,
                                                 struct MultiAxisSensor * sensor);
 
+/** @ingroup util
+ *
+ * Get the raw fixed-point values of a MEOut packet section without converting them
+ * to float. Each of these takes the same packet and returns the same codes as the
+ * float function of the same name without the Raw suffix.
+ *
+ * @param meOutPkt A pointer to the MEOut packet to extract the section from.
+ * @param sensor A pointer to where to store the raw values, scale and Q format.
+ *        Uses the same coordinates as the float function.
+ * @return 0 if successful.
+ *         -1 if the format flag was not set for the field.
+ *         -2 if the meOutPkt does not contain the field at all.
+ *         -3 if the format select number is unrecognized.
+ */
+LIBFREESPACE_API int freespace_util_getAccelerationRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getAccNoGravity(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getAccNoGravityRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getAngularVelocity(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getAngularVelocityRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                          struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getMagnetometer(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getMagnetometerRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                       struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getTemperature(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getTemperatureRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                      struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getInclination(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getInclinationRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                      struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getCompassHeading(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getCompassHeadingRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                         struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getAngPos(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getAngPosRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                 struct MultiAxisSensorRaw * sensor);
+
+/** @ingroup util
+ * Raw variant of freespace_util_getActClass(). See freespace_util_getAccelerationRaw().
+ */
+LIBFREESPACE_API int freespace_util_getActClassRaw(struct freespace_MotionEngineOutput const * meOutPkt,
+                                                   struct MultiAxisSensorRaw * sensor);
+
+/** Bits returned by freespace_util_decodeAll() for each section present in a MEOut packet. */
+#define FREESPACE_UTIL_ACCELERATION     0x0001
+#define FREESPACE_UTIL_ACC_NO_GRAVITY   0x0002
+#define FREESPACE_UTIL_ANGULAR_VELOCITY 0x0004
+#define FREESPACE_UTIL_MAGNETOMETER     0x0008
+#define FREESPACE_UTIL_TEMPERATURE      0x0010
+#define FREESPACE_UTIL_INCLINATION      0x0020
+#define FREESPACE_UTIL_COMPASS_HEADING  0x0040
+#define FREESPACE_UTIL_ANG_POS          0x0080
+#define FREESPACE_UTIL_ACT_CLASS        0x0100
+
+/** This struct holds every section of a MEOut packet decoded by freespace_util_decodeAll().
+ * Each member uses the same units and coordinates as the matching freespace_util_get* function.
+ * Members for sections that are not present in the packet are left untouched.
+ */
+struct freespace_MEOutputAll {
+    /** See freespace_util_getAcceleration() */
+    struct MultiAxisSensor acceleration;
+    /** See freespace_util_getAccNoGravity() */
+    struct MultiAxisSensor accNoGravity;
+    /** See freespace_util_getAngularVelocity() */
+    struct MultiAxisSensor angularVelocity;
+    /** See freespace_util_getMagnetometer() */
+    struct MultiAxisSensor magnetometer;
+    /** See freespace_util_getTemperature() */
+    struct MultiAxisSensor temperature;
+    /** See freespace_util_getInclination() */
+    struct MultiAxisSensor inclination;
+    /** See freespace_util_getCompassHeading() */
+    struct MultiAxisSensor compassHeading;
+    /** See freespace_util_getAngPos() */
+    struct MultiAxisSensor angPos;
+    /** See freespace_util_getActClass() */
+    struct MultiAxisSensor actClass;
+};
+
+/** @ingroup util
+ *
+ * Decode every section of a MEOut packet in a single pass over the format flags.
+ * This gives the same values as calling each of the freespace_util_get* functions
+ * but only walks the packet once.
+ *
+ * @param meOutPkt A pointer to the MEOut packet to decode.
+ * @param all A pointer to where to store the extracted values.
+ * @return a bitmask of the FREESPACE_UTIL_* sections that were decoded, which is 0
+ *         if the packet contains none of them.
+ *         -3 if the format select number is unrecognized.
+ */
+LIBFREESPACE_API int freespace_util_decodeAll(struct freespace_MotionEngineOutput const * meOutPkt,
+                                              struct freespace_MEOutputAll * all);
+
+/** Float columns filled by freespace_util_convertBatch(). Each column needs
+ * room for one value per packet. Axes are ordered as named; NULL columns are skipped.
+ * Units match the freespace_util_get* function for the same section.
+ */
+struct freespace_MEOutputColumns {
+    /** X, Y, Z */
+    float* acceleration[3];
+    /** X, Y, Z */
+    float* accNoGravity[3];
+    /** X, Y, Z */
+    float* angularVelocity[3];
+    /** X, Y, Z */
+    float* magnetometer[3];
+    /** W */
+    float* temperature;
+    /** X, Y, Z */
+    float* inclination[3];
+    /** X */
+    float* compassHeading;
+    /** W, X, Y, Z */
+    float* angPos[4];
+    /** Activity classification flags, power management flags */
+    float* actClass[2];
+};
+
+/** @ingroup util
+ *
+ * Convert a block of MEOut packets that share the same format select and format
+ * flags into float columns, one per axis of each requested section. This is
+ * intended for processing recorded data and uses SIMD conversion where available.
+ * Results for the decimal scales of format 1 may differ from the per-packet
+ * functions in the last bit.
+ *
+ * @param meOutPkts The packets to convert.
+ * @param count The number of packets.
+ * @param sections A bitmask of the FREESPACE_UTIL_* sections to convert.
+ * @param columns The columns to write to.
+ * @return a bitmask of the requested sections that were present and converted.
+ *         -3 if the format select number is unrecognized.
+ *         -4 if the packets do not all share the same format select and format flags.
+ */
+LIBFREESPACE_API int freespace_util_convertBatch(struct freespace_MotionEngineOutput const * meOutPkts,
+                                                 int count,
+                                                 int sections,
+                                                 struct freespace_MEOutputColumns * columns);
+
+/** @ingroup util
+ *
+ * Get the number of sensor axes decoded from a DceOut message type by
+ * freespace_util_decodeDceOut().
+ *
+ * @param messageType FREESPACE_MESSAGE_DCEOUTV2, V3, V4T0 or V4T1
+ * @return the number of axes, or an error if messageType is not a DceOut message
+ */
+LIBFREESPACE_API int freespace_util_getDceOutAxisCount(int messageType);
+
+/** @ingroup util
+ *
+ * Decode the sensor axes of a block of DceOut reports into one int16
+ * column per axis. The axes are in report order:
+ * DceOutV2 has ax, ay, az, rx, ry, rz, mx, my, mz and temperature.
+ * DceOutV3 and DceOutV4T0 have ax, ay, az, rx, ry, rz and temperature.
+ * DceOutV4T1 has mx, my and mz.
+ * SSE4.1 or AVX2 kernels are used when the processor supports them.
+ *
+ * @param messageType the type of every report in the block
+ * @param reports count reports, stride bytes apart
+ * @param stride the distance between the start of consecutive reports
+ * @param count the number of reports
+ * @param axes an array of freespace_util_getDceOutAxisCount() columns, each
+ *             with room for count values. NULL columns are skipped.
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_util_decodeDceOut(int messageType,
+                                                 const uint8_t* reports,
+                                                 int stride,
+                                                 int count,
+                                                 int16_t* const* axes);
+
+/** @ingroup util
+ *
+ * Decode the sensor axes of a block of DceOut reports into float columns.
+ * See freespace_util_decodeDceOut() for the order of the axes.
+ *
+ * @param messageType the type of every report in the block
+ * @param reports count reports, stride bytes apart
+ * @param stride the distance between the start of consecutive reports
+ * @param count the number of reports
+ * @param scale a factor to multiply each axis by, or NULL for none
+ * @param axes the columns to decode into. NULL columns are skipped.
+ * @return FREESPACE_SUCCESS or an error
+ */
+LIBFREESPACE_API int freespace_util_decodeDceOutFloat(int messageType,
+                                                      const uint8_t* reports,
+                                                      int stride,
+                                                      int count,
+                                                      const float* scale,
+                                                      float* const* axes);
+
 #ifdef __cplusplus
 }
 #endif
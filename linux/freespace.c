@@ -22,14 +22,29 @@
 #include "freespace/freespace_deviceTable.h"
 #include "hotplug.h"
 #include "freespace_config.h"
+#include "freespace_router.h"
 
 #include <libusb-1.0/libusb.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <poll.h>
+#include <sys/time.h>
 #include <string.h>
 
-#define FREESPACE_RECEIVE_QUEUE_SIZE 8 // Could be tuned better. 3-4 might be good enough
+#define FREESPACE_RECEIVE_QUEUE_SIZE 8 // Default depth. See freespace_setReceiveQueueSize().
+#define FREESPACE_SEND_POOL_SIZE FREESPACE_SEND_PIPELINE_DEPTH_MAX // Preallocated send transfers per device.
+#define FREESPACE_SEND_TIMEOUT_MS 1000 // Default timeout for synchronous sends.
+#define FREESPACE_RECEIVE_LEND_SPARES 4 // Internal spare buffers for freespace_borrowReport().
+#define FREESPACE_RECEIVE_QUEUE_SHRINK_READS 256 // Reads without a full queue before an adaptive queue shrinks.
+#define FREESPACE_RECEIVE_SPARE_MAX (FREESPACE_RECEIVE_BUFFERS_MAX + FREESPACE_RECEIVE_LEND_SPARES)
+
+// libusb gained native hotplug support in 1.0.16. When it is available, it
+// reports individual device arrivals and departures so that we don't need
+// to listen to uevents and rescan the whole bus.
+#if (defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000102) || \
+    (defined(LIBUSBX_API_VERSION) && LIBUSBX_API_VERSION >= 0x01000102)
+#define FREESPACE_LIBUSB_HOTPLUG
+#endif
 
 /**
  * The device state is primarily used to keep track of FreespaceDevice allocations.
@@ -61,13 +76,35 @@ struct FreespaceReceiveTransfer {
     // Convenience backpointer to the device data structure.
     struct FreespaceDevice* device_;
 
-    // Transfer information
+    // Transfer information. The buffer is swapped for a spare one when
+    // its report is lent out by freespace_borrowReport().
     struct libusb_transfer* transfer_;
-    uint8_t buffer_[FREESPACE_MAX_INPUT_MESSAGE_SIZE];
+    uint8_t* buffer_;
 
     // Synchronous interface usage for the state of the
     // queue.
     int submitted_;
+
+    // Set when the transfer could not be resubmitted after its report was
+    // consumed. The buffer holds stale data until a resubmit succeeds.
+    int stale_;
+};
+
+struct FreespaceSendTransfer {
+    // Convenience backpointer to the device data structure.
+    struct FreespaceDevice* device_;
+
+    // Transfer information
+    struct libusb_transfer* transfer_;
+    uint8_t buffer_[FREESPACE_MAX_OUTPUT_MESSAGE_SIZE];
+
+    // Completion callback information
+    FreespaceDeviceId id_;
+    freespace_sendCallback callback_;
+    void* cookie_;
+
+    int submitted_;
+    struct FreespaceSendTransfer* next_;
 };
 
 struct FreespaceDevice {
@@ -94,8 +131,59 @@ struct FreespaceDevice {
     void* receiveCookie_;
     void* receiveMessageCookie_;
 
+    // Message filter and per-type callbacks.
+    struct FreespaceMessageRouter router_;
+
+    // Receive queue configuration, applied when the device is opened.
+    int receiveQueueSize_;
+    int receiveQueueFlags_;
+
+    // The receive queue is a ring over the first receiveQueueDepth_
+    // of receiveQueueCapacity_ allocated entries. With
+    // FREESPACE_RECEIVE_QUEUE_ADAPTIVE, the depth grows toward
+    // receiveQueueTargetDepth_ each time the ring wraps. It shrinks back
+    // toward receiveQueueBaseDepth_ by retiring the entries from
+    // receiveQueueRetireFrom_ on as the head passes them.
     int receiveQueueHead_;
-    struct FreespaceReceiveTransfer receiveQueue_[FREESPACE_RECEIVE_QUEUE_SIZE];
+    int receiveQueueDepth_;
+    int receiveQueueTargetDepth_;
+    int receiveQueueBaseDepth_;
+    int receiveQueueRetireFrom_;
+    int receiveQueueQuietReads_;
+    int receiveQueueCapacity_;
+    struct FreespaceReceiveTransfer* receiveQueue_;
+
+    // Report buffers. Each receive queue entry holds one, and the rest
+    // are spares waiting to replace a buffer that is lent out.
+    uint8_t* receiveBufferStorage_;
+    uint8_t* receiveSpares_[FREESPACE_RECEIVE_SPARE_MAX];
+    int receiveSpareCount_;
+    int receiveRegisteredCount_;
+
+    // Buffers currently lent out, so that releases can be checked.
+    uint8_t* receiveLent_[FREESPACE_RECEIVE_SPARE_MAX];
+    int receiveLentCount_;
+
+    // Receive statistics
+    uint32_t receiveQueueFullCount_;
+    uint32_t receiveResubmitFailureCount_;
+
+    // Set when a resubmit fails, so that asynchronous receives retry the
+    // stale entries. See resubmitStaleTransfers().
+    int receiveHasStale_;
+
+    // Set while the receive queue is torn down, so that completions are
+    // neither delivered nor resubmitted.
+    int receiveClosing_;
+
+    // Outbound pipeline. Sends draw from this pool, so the send path does
+    // not allocate. At most sendDepth_ transfers are in flight at a time and
+    // libusb completes them in submission order.
+    struct FreespaceSendTransfer sendPool_[FREESPACE_SEND_POOL_SIZE];
+    struct FreespaceSendTransfer* sendFreeList_;
+    int sendDepth_;
+    int sendInFlight_;
+    unsigned int sendTimeoutMs_;
 };
 
 static struct FreespaceDevice* devices[FREESPACE_MAXIMUM_DEVICE_COUNT];
@@ -109,6 +197,27 @@ static freespace_pollfdRemovedCallback userRemovedCallback = NULL;
 static freespace_hotplugCallback hotplugCallback = NULL;
 static void* hotplugCookie;
 
+// Set when libusb delivers hotplug events and the uevent listener is unused.
+static int useLibusbHotplug = 0;
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+#define FREESPACE_HOTPLUG_EVENTS_MAX 32 // Hotplug events queued between scans.
+
+static int libusbHotplugRegistered = 0;
+static libusb_hotplug_callback_handle libusbHotplugHandle;
+
+// libusb reports hotplug events from inside its event handling, where the
+// application can't safely open devices or send. They are queued here and
+// delivered by scanDevices() instead. Each queued device holds a reference.
+struct FreespaceHotplugEvent {
+    libusb_hotplug_event event_;
+    struct libusb_device* dev_;
+};
+static struct FreespaceHotplugEvent libusbHotplugEvents[FREESPACE_HOTPLUG_EVENTS_MAX];
+static int libusbHotplugEventCount = 0;
+static int libusbHotplugOverflow = 0;
+static int libusbHotplugDelivering = 0;
+#endif
+
 static int libusb_to_freespace_error(int libusberror) {
     // libusb returns values greater than 0 for success for some functions.
     if (libusberror >= 0) {
@@ -153,18 +262,42 @@ const char* freespace_version() {
 int freespace_init() {
     int rc;
 
-    rc = freespace_hotplug_init();
-    if (rc != FREESPACE_SUCCESS) {
-        return rc;
+    rc = libusb_init(&freespace_libusb_context);
+    if (rc != LIBUSB_SUCCESS) {
+        return libusb_to_freespace_error(rc);
     }
 
-    rc = libusb_init(&freespace_libusb_context);
-    return libusb_to_freespace_error(rc);
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+    useLibusbHotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG);
+#endif
+    if (!useLibusbHotplug) {
+        rc = freespace_hotplug_init();
+        if (rc != FREESPACE_SUCCESS) {
+            libusb_exit(freespace_libusb_context);
+            freespace_libusb_context = NULL;
+            return rc;
+        }
+    }
+
+    return FREESPACE_SUCCESS;
 }
 
 void freespace_exit() {
     struct FreespaceDevice* device;
     int i;
+
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+    if (libusbHotplugRegistered) {
+        libusb_hotplug_deregister_callback(freespace_libusb_context, libusbHotplugHandle);
+        libusbHotplugRegistered = 0;
+    }
+    for (i = 0; i < libusbHotplugEventCount; i++) {
+        libusb_unref_device(libusbHotplugEvents[i].dev_);
+    }
+    libusbHotplugEventCount = 0;
+    libusbHotplugOverflow = 0;
+#endif
+
     for (i = 0; i < FREESPACE_MAXIMUM_DEVICE_COUNT; i++) {
         if (devices[i] != NULL) {
             device = devices[i];
@@ -178,7 +311,9 @@ void freespace_exit() {
         }
     }
     libusb_exit(freespace_libusb_context);
-    freespace_hotplug_exit();
+    if (!useLibusbHotplug) {
+        freespace_hotplug_exit();
+    }
 }
 
 static struct FreespaceDeviceAPI const * lookupDevice(struct libusb_device_descriptor* desc) {
@@ -245,18 +380,77 @@ static void removeFreespaceDevice(struct FreespaceDevice* device) {
     }
 }
 
-static int scanDevices() {
-    struct libusb_device** devs;
-    ssize_t count;
-    ssize_t i;
+// Start tracking a newly attached device if it is a known Freespace device.
+static int insertDevice(struct libusb_device* dev) {
+    struct libusb_device_descriptor desc;
+    struct FreespaceDeviceAPI const * api;
+    struct FreespaceDevice* device;
     int rc;
-    int needToRescan;
 
-    // Check if the devices need to be rescanned.
-    rc = freespace_hotplug_perform(&needToRescan);
-    if (rc != FREESPACE_SUCCESS || !needToRescan) {
+    rc = libusb_get_device_descriptor(dev, &desc);
+    if (rc < 0) {
+        // Can't get the device descriptor, so skip it.
+        return FREESPACE_SUCCESS;
+    }
+
+    // Find if this device is in the known list.
+    api = lookupDevice(&desc);
+    if (api == NULL) {
+        return FREESPACE_SUCCESS;
+    }
+
+    device = findDeviceById(libusb_get_device_address(dev));
+    if (device != NULL) {
+        device->ts_ = ts;
+        return FREESPACE_SUCCESS;
+    }
+
+    device = (struct FreespaceDevice*) malloc(sizeof(struct FreespaceDevice));
+    if (device == NULL) {
+        // Out of memory.
+        return FREESPACE_ERROR_OUT_OF_MEMORY;
+    }
+    memset(device, 0, sizeof(struct FreespaceDevice));
+
+    libusb_ref_device(dev);
+    device->dev_ = dev;
+    device->idProduct_ = desc.idProduct;
+    device->idVendor_ = desc.idVendor;
+    device->api_ = api;
+    device->id_ = libusb_get_device_address(dev);
+    device->state_ = FREESPACE_CONNECTED;
+    device->ts_ = ts;
+    rc = addFreespaceDevice(device);
+    if (rc != FREESPACE_SUCCESS) {
+        libusb_unref_device(dev);
+        free(device);
         return rc;
     }
+    if (hotplugCallback) {
+        hotplugCallback(FREESPACE_HOTPLUG_INSERTION, device->id_, hotplugCookie);
+    }
+    return FREESPACE_SUCCESS;
+}
+
+// Stop tracking a device that has been unplugged.
+static void disconnectDevice(struct FreespaceDevice* device) {
+    if (hotplugCallback) {
+        hotplugCallback(FREESPACE_HOTPLUG_REMOVAL, device->id_, hotplugCookie);
+    }
+    if (device->state_ == FREESPACE_OPENED) {
+        device->state_ = FREESPACE_DISCONNECTED;
+    } else {
+        removeFreespaceDevice(device);
+    }
+}
+
+// Rescan the whole bus, inserting new devices and disconnecting the ones
+// that are gone.
+static int rescanDeviceList() {
+    struct libusb_device** devs;
+    ssize_t count;
+    ssize_t i;
+    int rc;
 
     count = libusb_get_device_list(freespace_libusb_context, &devs);
     if (count < 0) {
@@ -265,59 +459,17 @@ static int scanDevices() {
 
     ts++;
     for (i = 0; i < count; i++) {
-        struct libusb_device_descriptor desc;
-        struct libusb_device* dev = devs[i];
-        struct FreespaceDeviceAPI const * api;
-
-        rc = libusb_get_device_descriptor(dev, &desc);
-        if (rc < 0) {
-            // Can't get the device descriptor, so try the next one.
-            continue;
-        }
-
-        // Find if this device is in the known list.
-        api = lookupDevice(&desc);
-        if (api != NULL) {
-            uint8_t deviceAddress = libusb_get_device_address(dev);
-            struct FreespaceDevice* device;
-            device = findDeviceById(deviceAddress);
-            if (device == NULL) {
-                device = (struct FreespaceDevice*) malloc(sizeof(struct FreespaceDevice));
-                if (device == NULL) {
-                    // Out of memory.
-                    libusb_free_device_list(devs, 1);
-                    return FREESPACE_ERROR_OUT_OF_MEMORY;
-                }
-                memset(device, 0, sizeof(struct FreespaceDevice));
-
-                libusb_ref_device(dev);
-                device->dev_ = dev;
-                device->idProduct_ = desc.idProduct;
-                device->idVendor_ = desc.idVendor;
-                device->api_ = api;
-                device->id_ = libusb_get_device_address(dev);
-                device->state_ = FREESPACE_CONNECTED;
-                device->ts_ = ts;
-                addFreespaceDevice(device);
-                if (hotplugCallback) {
-                    hotplugCallback(FREESPACE_HOTPLUG_INSERTION, device->id_, hotplugCookie);
-                }
-            }
-            device->ts_ = ts;
+        rc = insertDevice(devs[i]);
+        if (rc == FREESPACE_ERROR_OUT_OF_MEMORY) {
+            libusb_free_device_list(devs, 1);
+            return rc;
         }
     }
 
     for (i = 0; i < FREESPACE_MAXIMUM_DEVICE_COUNT; i++) {
         struct FreespaceDevice* d = devices[i];
         if (d != NULL && d->ts_ != ts) {
-            if (hotplugCallback) {
-                hotplugCallback(FREESPACE_HOTPLUG_REMOVAL, d->id_, hotplugCookie);
-            }
-            if (d->state_ == FREESPACE_OPENED) {
-                d->state_ = FREESPACE_DISCONNECTED;
-            } else {
-                removeFreespaceDevice(d);
-            }
+            disconnectDevice(d);
         }
     }
 
@@ -325,6 +477,135 @@ static int scanDevices() {
     return FREESPACE_SUCCESS;
 }
 
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+static struct FreespaceDevice* findDeviceByLibusbDevice(struct libusb_device* dev) {
+    int i;
+    for (i = 0; i < FREESPACE_MAXIMUM_DEVICE_COUNT; i++) {
+        struct FreespaceDevice* d = devices[i];
+        if (d != NULL && d->dev_ == dev && d->state_ != FREESPACE_DISCONNECTED) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static int LIBUSB_CALL libusbHotplugCallback(struct libusb_context* ctx,
+                                             struct libusb_device* dev,
+                                             libusb_hotplug_event event,
+                                             void* user_data) {
+    struct libusb_device_descriptor desc;
+
+    // Only queue the events that concern Freespace devices.
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        if (libusb_get_device_descriptor(dev, &desc) < 0 || lookupDevice(&desc) == NULL) {
+            return 0;
+        }
+    } else if (event != LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT || findDeviceByLibusbDevice(dev) == NULL) {
+        return 0;
+    }
+
+    if (libusbHotplugEventCount < FREESPACE_HOTPLUG_EVENTS_MAX) {
+        libusbHotplugEvents[libusbHotplugEventCount].event_ = event;
+        libusbHotplugEvents[libusbHotplugEventCount].dev_ = libusb_ref_device(dev);
+        libusbHotplugEventCount++;
+    } else {
+        // Too many events at once. Fall back to a full rescan.
+        libusbHotplugOverflow = 1;
+    }
+
+    // Returning 0 keeps this callback registered.
+    return 0;
+}
+
+// Deliver the hotplug events queued by libusbHotplugCallback(). The
+// application's callback may scan again, so events queued meanwhile are
+// delivered by the outer call.
+static int deliverLibusbHotplugEvents() {
+    int rc = FREESPACE_SUCCESS;
+    int i;
+
+    if (libusbHotplugDelivering) {
+        return FREESPACE_SUCCESS;
+    }
+    libusbHotplugDelivering = 1;
+
+    for (i = 0; i < libusbHotplugEventCount; i++) {
+        struct libusb_device* dev = libusbHotplugEvents[i].dev_;
+        if (libusbHotplugEvents[i].event_ == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+            insertDevice(dev);
+        } else {
+            struct FreespaceDevice* d = findDeviceByLibusbDevice(dev);
+            if (d != NULL) {
+                disconnectDevice(d);
+            }
+        }
+        libusb_unref_device(dev);
+    }
+    libusbHotplugEventCount = 0;
+
+    if (libusbHotplugOverflow) {
+        libusbHotplugOverflow = 0;
+        rc = rescanDeviceList();
+    }
+
+    libusbHotplugDelivering = 0;
+    return rc;
+}
+
+static int scanDevicesLibusbHotplug() {
+    struct timeval tv = {0, 0};
+    int rc;
+
+    if (!libusbHotplugRegistered) {
+        // Registration is deferred until the first scan so that the
+        // insertion callbacks for devices that are already attached go to
+        // the hotplug callback that the application set up after init.
+        // LIBUSB_HOTPLUG_ENUMERATE reports those devices immediately.
+        rc = libusb_hotplug_register_callback(freespace_libusb_context,
+                                              LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                              LIBUSB_HOTPLUG_ENUMERATE,
+                                              LIBUSB_HOTPLUG_MATCH_ANY,
+                                              LIBUSB_HOTPLUG_MATCH_ANY,
+                                              LIBUSB_HOTPLUG_MATCH_ANY,
+                                              libusbHotplugCallback,
+                                              NULL,
+                                              &libusbHotplugHandle);
+        if (rc != LIBUSB_SUCCESS) {
+            return libusb_to_freespace_error(rc);
+        }
+        libusbHotplugRegistered = 1;
+    } else {
+        // Hotplug events are reported from libusb's event handling, so give
+        // any pending ones a chance to be queued for synchronous API users.
+        rc = libusb_handle_events_timeout(freespace_libusb_context, &tv);
+        if (rc != LIBUSB_SUCCESS) {
+            return libusb_to_freespace_error(rc);
+        }
+    }
+
+    return deliverLibusbHotplugEvents();
+}
+#endif
+
+static int scanDevices() {
+    int rc;
+    int needToRescan;
+
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+    if (useLibusbHotplug) {
+        return scanDevicesLibusbHotplug();
+    }
+#endif
+
+    // Check if the devices need to be rescanned.
+    rc = freespace_hotplug_perform(&needToRescan);
+    if (rc != FREESPACE_SUCCESS || !needToRescan) {
+        return rc;
+    }
+
+    return rescanDeviceList();
+}
+
 int freespace_setDeviceHotplugCallback(freespace_hotplugCallback callback,
                                        void* cookie) {
     hotplugCallback = callback;
@@ -369,66 +650,216 @@ int freespace_getDeviceInfo(FreespaceDeviceId id,
     }
 }
 
+static int submitReceiveTransfer(struct FreespaceDevice* device,
+                                 struct FreespaceReceiveTransfer* rt) {
+    int rc = libusb_submit_transfer(rt->transfer_);
+    if (rc == LIBUSB_SUCCESS) {
+        rt->submitted_ = 1;
+        rt->stale_ = 0;
+    } else {
+        rt->submitted_ = 0;
+        rt->stale_ = 1;
+        device->receiveHasStale_ = 1;
+        device->receiveResubmitFailureCount_++;
+    }
+    return libusb_to_freespace_error(rc);
+}
+
+static void receiveCallback(struct libusb_transfer* transfer);
+
+static int allocateReceiveTransfer(struct FreespaceDevice* device,
+                                   struct FreespaceReceiveTransfer* rt) {
+    rt->device_ = device;
+    rt->submitted_ = 0;
+    rt->stale_ = 0;
+    rt->transfer_ = libusb_alloc_transfer(0);
+    if (rt->transfer_ == NULL) {
+        return FREESPACE_ERROR_OUT_OF_MEMORY;
+    }
+    libusb_fill_interrupt_transfer(rt->transfer_,
+                                   device->handle_,
+                                   device->readEndpointAddress_,
+                                   rt->buffer_,
+                                   device->maxReadSize_,
+                                   receiveCallback,
+                                   rt,
+                                   0);
+    return FREESPACE_SUCCESS;
+}
+
+// Submit transfers until the queue reaches its target depth. Growth only
+// happens when the head is at index 0 so that the ring order continues to
+// match the order in which the transfers were submitted.
+static void growReceiveQueue(struct FreespaceDevice* device) {
+    while (device->receiveQueueDepth_ < device->receiveQueueTargetDepth_) {
+        struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[device->receiveQueueDepth_];
+        if (allocateReceiveTransfer(device, rt) != FREESPACE_SUCCESS) {
+            break;
+        }
+        if (submitReceiveTransfer(device, rt) != FREESPACE_SUCCESS) {
+            libusb_free_transfer(rt->transfer_);
+            rt->transfer_ = NULL;
+            break;
+        }
+        device->receiveQueueDepth_++;
+    }
+    device->receiveQueueTargetDepth_ = device->receiveQueueDepth_;
+    device->receiveQueueRetireFrom_ = device->receiveQueueDepth_;
+}
+
+// Halve an adaptive queue that has gone FREESPACE_RECEIVE_QUEUE_SHRINK_READS
+// reads without filling up, but not below the configured depth. Entries
+// past the new depth are retired as the head passes them during the next
+// lap, and the depth drops when the ring wraps again.
+static void shrinkReceiveQueue(struct FreespaceDevice* device) {
+    int depth;
+
+    if (!(device->receiveQueueFlags_ & FREESPACE_RECEIVE_QUEUE_ADAPTIVE) ||
+        device->receiveQueueQuietReads_ < FREESPACE_RECEIVE_QUEUE_SHRINK_READS ||
+        device->receiveQueueDepth_ <= device->receiveQueueBaseDepth_) {
+        return;
+    }
+
+    depth = device->receiveQueueDepth_ / 2;
+    if (depth < device->receiveQueueBaseDepth_) {
+        depth = device->receiveQueueBaseDepth_;
+    }
+    device->receiveQueueTargetDepth_ = depth;
+    device->receiveQueueRetireFrom_ = depth;
+    device->receiveQueueQuietReads_ = 0;
+}
+
+// Resubmit an entry whose report was consumed, or free its transfer if the
+// queue is shrinking past it.
+static int recycleReceiveTransfer(struct FreespaceDevice* device,
+                                  struct FreespaceReceiveTransfer* rt) {
+    if (rt - device->receiveQueue_ >= device->receiveQueueRetireFrom_) {
+        libusb_free_transfer(rt->transfer_);
+        rt->transfer_ = NULL;
+        rt->submitted_ = 0;
+        rt->stale_ = 0;
+        return FREESPACE_SUCCESS;
+    }
+    return submitReceiveTransfer(device, rt);
+}
+
+// Move the receive queue head past the report that was just consumed.
+static void advanceReceiveQueue(struct FreespaceDevice* device) {
+    device->receiveQueueHead_++;
+    if (device->receiveQueueHead_ >= device->receiveQueueDepth_) {
+        device->receiveQueueHead_ = 0;
+        // The entries being retired were all passed during this lap.
+        device->receiveQueueDepth_ = device->receiveQueueRetireFrom_;
+        growReceiveQueue(device);
+        shrinkReceiveQueue(device);
+    }
+}
+
+// True when received reports go to callbacks rather than to the receive queue.
+static int isAsyncReceive(struct FreespaceDevice* device) {
+    return device->receiveCallback_ != NULL ||
+           device->receiveMessageCallback_ != NULL ||
+           device->router_.typeCallbackCount_ > 0 ||
+           device->router_.subscriberCount_ > 0;
+}
+
+// In async mode nothing walks the ring, so retry every entry whose
+// resubmit failed. Otherwise each failure would lose a transfer for good.
+// Sync mode retries each stale entry as the head reaches it. See
+// waitForReceive().
+static void resubmitStaleTransfers(struct FreespaceDevice* device) {
+    int i;
+
+    if (!device->receiveHasStale_ || !isAsyncReceive(device)) {
+        return;
+    }
+    device->receiveHasStale_ = 0;
+    for (i = 0; i < device->receiveQueueDepth_; i++) {
+        struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
+        if (rt->stale_ && !rt->submitted_ && rt->transfer_ != NULL) {
+            submitReceiveTransfer(device, rt);
+        }
+    }
+}
+
 static void receiveCallback(struct libusb_transfer* transfer) {
     struct FreespaceReceiveTransfer* rt = (struct FreespaceReceiveTransfer*) transfer->user_data;
     struct FreespaceDevice* device = rt->device_;
 
-    if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED || device->receiveClosing_) {
         // Canceled. This only happens on cleanup. Don't report errors or resubmit.
         rt->submitted_ = 0;
         return;
     }
 
-    if (device->receiveCallback_ != NULL || device->receiveMessageCallback_ != NULL) {
+    if (isAsyncReceive(device)) {
         // Using async interface, so call user back immediately.
         int rc = libusb_transfer_status_to_freespace_error(transfer->status);
         if (device->receiveCallback_ != NULL) {
             device->receiveCallback_(device->id_, (const uint8_t*) transfer->buffer, transfer->actual_length, device->receiveCookie_, rc);
         }
-        if (device->receiveMessageCallback_ != NULL) {
-            struct freespace_message m;
-            
-            rc = freespace_decode_message((const uint8_t*) transfer->buffer, transfer->actual_length, &m, device->api_->hVer_);
-            if (rc == FREESPACE_SUCCESS) {
-                device->receiveMessageCallback_(device->id_, &m, device->receiveMessageCookie_, FREESPACE_SUCCESS);
-            } else {
-                device->receiveMessageCallback_(device->id_, NULL, device->receiveMessageCookie_, rc);
-            }
-        }
+        freespace_private_routeMessage(&device->router_, device->id_,
+                                       (const uint8_t*) transfer->buffer, transfer->actual_length, device->api_->hVer_,
+                                       device->receiveMessageCallback_, device->receiveMessageCookie_);
 
         // Re-submit the transfer for the to get the next receive going.
-        // NOTE: Can't handle any error returns here.
-        libusb_submit_transfer(transfer);
+        // Failures are counted and retried on the next successful resubmit
+        // or freespace_perform().
+        if (submitReceiveTransfer(device, rt) == FREESPACE_SUCCESS) {
+            resubmitStaleTransfers(device);
+        }
     } else {
         // Using sync interface, so queue.
         rt->submitted_ = 0;
     }
 }
 
+// Receive transfers still in flight when their queue was torn down. The
+// ring holds the transfers' user_data and the storage may still be
+// written into, so both are freed by the last of their callbacks rather
+// than at close.
+struct FreespaceReceiveOrphans {
+    int pending_;
+    struct FreespaceReceiveTransfer* queue_;
+    uint8_t* storage_;
+};
+
+// Completion callback for an orphaned receive transfer. The device may be
+// freed by now, so only the transfer and the orphaned ring are touched.
+static void orphanedReceiveCallback(struct libusb_transfer* transfer) {
+    struct FreespaceReceiveOrphans* orphans = (struct FreespaceReceiveOrphans*) transfer->user_data;
+
+    libusb_free_transfer(transfer);
+    if (orphans != NULL && --orphans->pending_ == 0) {
+        free(orphans->queue_);
+        free(orphans->storage_);
+        free(orphans);
+    }
+}
+
 int freespace_terminateReceiveTransfers(struct FreespaceDevice* device) {
     int rc = LIBUSB_SUCCESS;
     int i;
-    int canceledCount = 0;
+    int pendingCount = 0;
     int retries;
+    struct FreespaceReceiveOrphans* orphans = NULL;
+
+    if (device->receiveQueue_ == NULL) {
+        return FREESPACE_SUCCESS;
+    }
+    device->receiveClosing_ = 1;
 
-    // Cancel all submitted transfers.
-    for (i = 0; i < FREESPACE_RECEIVE_QUEUE_SIZE; i++) {
+    // Cancel all submitted transfers. A transfer that is already completing
+    // may refuse the cancel, but its callback is still pending, so wait on
+    // submitted_ either way.
+    for (i = 0; i < device->receiveQueueCapacity_; i++) {
         struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
         if (rt->transfer_ != NULL) {
             if (rt->submitted_) {
-                rc = libusb_cancel_transfer(rt->transfer_);
-
                 // Do not free the transfer here. Transfer cancels are
                 // asynchronous. The callback will know what to do.
-
-                if (rc == LIBUSB_SUCCESS) {
-                    canceledCount++;
-                } else {
-                    // Force free on error.
-                    libusb_free_transfer(rt->transfer_);
-                    rt->transfer_ = NULL;
-                    rt->submitted_ = 0;
-                }
+                libusb_cancel_transfer(rt->transfer_);
+                pendingCount++;
             } else {
                 // Not submitted to libusb, so this can be freed immediatedly.
                 libusb_free_transfer(rt->transfer_);
@@ -440,8 +871,8 @@ int freespace_terminateReceiveTransfers(struct FreespaceDevice* device) {
     // Wait for the cancellation to finish up. libusb seems to cancel
     // one transfer per call to libusb_handle_events_timeout, so make the
     // retries take that into account and add slack.
-    retries = canceledCount * 3;
-    while (canceledCount > 0 && retries > 0) {
+    retries = pendingCount * 3;
+    while (pendingCount > 0 && retries > 0) {
         struct timeval tv;
 
         tv.tv_sec = 0;
@@ -452,50 +883,111 @@ int freespace_terminateReceiveTransfers(struct FreespaceDevice* device) {
             break;
         }
 
-        for (i = 0; i < FREESPACE_RECEIVE_QUEUE_SIZE; i++) {
+        for (i = 0; i < device->receiveQueueCapacity_; i++) {
             struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
             if (rt->transfer_ != NULL && rt->submitted_ == 0) {
                 // Cancel completed.
                 libusb_free_transfer(rt->transfer_);
                 rt->transfer_ = NULL;
-                canceledCount--;
+                pendingCount--;
             }
         }
 
         retries--;
     }
 
-    // Force clean any left.
-    for (i = 0; i < FREESPACE_RECEIVE_QUEUE_SIZE; i++) {
-        struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
-        if (rt->transfer_ != NULL) {
-            libusb_free_transfer(rt->transfer_);
-            rt->transfer_ = NULL;
+    // Still in flight after the wait. Freeing the transfers now would leave
+    // libusb with dangling transfers, so let their callbacks free them and
+    // hand them the ring and the buffers. Buffers registered by the caller
+    // are in use until freespace_closeDevice() closes the handle, which
+    // stops the kernel from writing into them.
+    if (pendingCount > 0) {
+        orphans = (struct FreespaceReceiveOrphans*) malloc(sizeof(struct FreespaceReceiveOrphans));
+        if (orphans != NULL) {
+            orphans->pending_ = pendingCount;
+            orphans->queue_ = device->receiveQueue_;
+            orphans->storage_ = device->receiveBufferStorage_;
+        }
+        for (i = 0; i < device->receiveQueueCapacity_; i++) {
+            struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
+            if (rt->transfer_ != NULL) {
+                // Without orphans the ring and the buffers are leaked
+                // rather than freed under the pending callbacks.
+                rt->transfer_->callback = orphanedReceiveCallback;
+                rt->transfer_->user_data = orphans;
+                rt->transfer_ = NULL;
+            }
         }
+    } else {
+        free(device->receiveQueue_);
+        free(device->receiveBufferStorage_);
     }
+    device->receiveClosing_ = 0;
+
+    device->receiveQueue_ = NULL;
+    device->receiveQueueCapacity_ = 0;
+    device->receiveQueueDepth_ = 0;
+
+    // Reports still lent out point into this storage or into buffers
+    // registered by the caller, which are forgotten here.
+    device->receiveBufferStorage_ = NULL;
+    device->receiveSpareCount_ = 0;
+    device->receiveRegisteredCount_ = 0;
+    device->receiveLentCount_ = 0;
 
     return libusb_to_freespace_error(rc);
 }
 
 int freespace_initiateReceiveTransfers(struct FreespaceDevice* device) {
-    int rc = LIBUSB_SUCCESS;
+    int rc = FREESPACE_SUCCESS;
+    int size;
     int i;
 
+    size = device->receiveQueueSize_ > 0 ? device->receiveQueueSize_ : FREESPACE_RECEIVE_QUEUE_SIZE;
+
+    // Adaptive queues reserve room to grow, but only allocate and
+    // submit transfers for the entries in use.
+    device->receiveQueueCapacity_ = (device->receiveQueueFlags_ & FREESPACE_RECEIVE_QUEUE_ADAPTIVE) ? FREESPACE_RECEIVE_QUEUE_SIZE_MAX : size;
+    device->receiveQueue_ = (struct FreespaceReceiveTransfer*) calloc(device->receiveQueueCapacity_,
+                                                                      sizeof(struct FreespaceReceiveTransfer));
+    if (device->receiveQueue_ == NULL) {
+        device->receiveQueueCapacity_ = 0;
+        return FREESPACE_ERROR_OUT_OF_MEMORY;
+    }
+
+    // One buffer per entry plus the internal spares for lending.
+    device->receiveBufferStorage_ = (uint8_t*) malloc((device->receiveQueueCapacity_ + FREESPACE_RECEIVE_LEND_SPARES) *
+                                                      FREESPACE_MAX_INPUT_MESSAGE_SIZE);
+    if (device->receiveBufferStorage_ == NULL) {
+        free(device->receiveQueue_);
+        device->receiveQueue_ = NULL;
+        device->receiveQueueCapacity_ = 0;
+        return FREESPACE_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < device->receiveQueueCapacity_; i++) {
+        device->receiveQueue_[i].buffer_ = device->receiveBufferStorage_ + i * FREESPACE_MAX_INPUT_MESSAGE_SIZE;
+    }
+    device->receiveSpareCount_ = 0;
+    device->receiveRegisteredCount_ = 0;
+    device->receiveLentCount_ = 0;
+    for (i = 0; i < FREESPACE_RECEIVE_LEND_SPARES; i++) {
+        device->receiveSpares_[device->receiveSpareCount_++] =
+            device->receiveBufferStorage_ + (device->receiveQueueCapacity_ + i) * FREESPACE_MAX_INPUT_MESSAGE_SIZE;
+    }
+
     device->receiveQueueHead_ = 0;
-    for (i = 0; i < FREESPACE_RECEIVE_QUEUE_SIZE; i++) {
+    device->receiveQueueDepth_ = size;
+    device->receiveQueueTargetDepth_ = size;
+    device->receiveQueueBaseDepth_ = size;
+    device->receiveQueueRetireFrom_ = size;
+    device->receiveQueueQuietReads_ = 0;
+    for (i = 0; i < size; i++) {
         struct FreespaceReceiveTransfer* rt = &device->receiveQueue_[i];
-        rt->device_ = device;
-        rt->transfer_ = libusb_alloc_transfer(0);
-        libusb_fill_interrupt_transfer(rt->transfer_,
-                                       device->handle_,
-                                       device->readEndpointAddress_,
-                                       rt->buffer_,
-                                       device->maxReadSize_,
-                                       receiveCallback,
-                                       rt,
-                                       0);
-        rc = libusb_submit_transfer(rt->transfer_);
-        if (rc != LIBUSB_SUCCESS) {
+        rc = allocateReceiveTransfer(device, rt);
+        if (rc == FREESPACE_SUCCESS) {
+            rc = libusb_to_freespace_error(libusb_submit_transfer(rt->transfer_));
+        }
+        if (rc != FREESPACE_SUCCESS) {
             freespace_terminateReceiveTransfers(device);
             break;
         }
@@ -503,29 +995,209 @@ int freespace_initiateReceiveTransfers(struct FreespaceDevice* device) {
         rt->submitted_ = 1;
     }
 
-    return libusb_to_freespace_error(rc);
+    return rc;
 }
 
-int freespace_openDevice(FreespaceDeviceId id) {
-    struct FreespaceDevice* device = findDeviceById(id);
-    struct libusb_config_descriptor *config;
-    const struct libusb_interface_descriptor* intd;
-    int controlInterfaceNumber;
-    int i;
-    int rc;
-
-    if (device == NULL) {
-        return FREESPACE_ERROR_NOT_FOUND;
+// Take a send transfer from the device's pool. Returns NULL when the
+// pipeline already has sendDepth_ transfers in flight.
+static struct FreespaceSendTransfer* acquireSendTransfer(struct FreespaceDevice* device) {
+    struct FreespaceSendTransfer* st = device->sendFreeList_;
+    if (st == NULL || device->sendInFlight_ >= device->sendDepth_) {
+        return NULL;
     }
+    device->sendFreeList_ = st->next_;
+    return st;
+}
 
-    rc = libusb_open(device->dev_, &device->handle_);
-    if (rc != LIBUSB_SUCCESS) {
-        return libusb_to_freespace_error(rc);
+static void releaseSendTransfer(struct FreespaceSendTransfer* st) {
+    struct FreespaceDevice* device = st->device_;
+    if (st->submitted_) {
+        st->submitted_ = 0;
+        device->sendInFlight_--;
     }
+    st->next_ = device->sendFreeList_;
+    device->sendFreeList_ = st;
+}
 
-    controlInterfaceNumber = device->api_->controlInterfaceNumber_;
-    rc = libusb_kernel_driver_active(device->handle_, controlInterfaceNumber);
-    if (rc == 1) {
+static void sendCallback(struct libusb_transfer* transfer) {
+    struct FreespaceSendTransfer* st = (struct FreespaceSendTransfer*) transfer->user_data;
+    int rc = libusb_transfer_status_to_freespace_error(transfer->status);
+    FreespaceDeviceId id = st->id_;
+    freespace_sendCallback callback = st->callback_;
+    void* cookie = st->cookie_;
+
+    // Return the transfer first so that the callback can send again.
+    releaseSendTransfer(st);
+
+    if (callback != NULL) {
+        callback(id, cookie, rc);
+    }
+}
+
+// Copy the message into a pooled transfer and submit it.
+static int submitSendTransfer(struct FreespaceDevice* device,
+                              struct FreespaceSendTransfer* st,
+                              const uint8_t* message,
+                              int length,
+                              unsigned int timeoutMs,
+                              freespace_sendCallback callback,
+                              void* cookie) {
+    int rc;
+
+    // The message is copied so that callers may pass a buffer that does
+    // not outlive this call.
+    memcpy(st->buffer_, message, length);
+    st->id_ = device->id_;
+    st->callback_ = callback;
+    st->cookie_ = cookie;
+
+    libusb_fill_interrupt_transfer(st->transfer_,
+                                   device->handle_,
+                                   device->writeEndpointAddress_,
+                                   st->buffer_,
+                                   length,
+                                   sendCallback,
+                                   st,
+                                   timeoutMs);
+
+    rc = libusb_submit_transfer(st->transfer_);
+    if (rc != LIBUSB_SUCCESS) {
+        releaseSendTransfer(st);
+        return libusb_to_freespace_error(rc);
+    }
+    st->submitted_ = 1;
+    device->sendInFlight_++;
+
+    return FREESPACE_SUCCESS;
+}
+
+static int freespace_initiateSendPool(struct FreespaceDevice* device) {
+    int i;
+
+    if (device->sendDepth_ <= 0) {
+        device->sendDepth_ = FREESPACE_SEND_POOL_SIZE;
+    }
+    if (device->sendTimeoutMs_ == 0) {
+        device->sendTimeoutMs_ = FREESPACE_SEND_TIMEOUT_MS;
+    }
+    device->sendInFlight_ = 0;
+    device->sendFreeList_ = NULL;
+    for (i = FREESPACE_SEND_POOL_SIZE - 1; i >= 0; i--) {
+        struct FreespaceSendTransfer* st = &device->sendPool_[i];
+        st->device_ = device;
+        st->submitted_ = 0;
+        st->transfer_ = libusb_alloc_transfer(0);
+        if (st->transfer_ == NULL) {
+            return FREESPACE_ERROR_OUT_OF_MEMORY;
+        }
+        st->next_ = device->sendFreeList_;
+        device->sendFreeList_ = st;
+    }
+
+    return FREESPACE_SUCCESS;
+}
+
+// Completion callback for a send transfer still in flight when its pool
+// was torn down. The pool entry may be reused or freed by now, so only
+// the transfer itself is touched.
+static void orphanedSendCallback(struct libusb_transfer* transfer) {
+    libusb_free_transfer(transfer);
+}
+
+#ifndef __APPLE__
+// Give up on an in-flight send whose callback can no longer be waited for.
+// The transfer frees itself when it completes and the pool entry gets a
+// new one, or leaves the pool if that cannot be allocated.
+static void orphanSendTransfer(struct FreespaceSendTransfer* st) {
+    struct FreespaceDevice* device = st->device_;
+
+    st->transfer_->callback = orphanedSendCallback;
+    st->transfer_->user_data = NULL;
+    st->transfer_ = libusb_alloc_transfer(0);
+    if (st->transfer_ != NULL) {
+        releaseSendTransfer(st);
+    } else {
+        st->submitted_ = 0;
+        device->sendInFlight_--;
+    }
+}
+#endif
+
+static int freespace_terminateSendPool(struct FreespaceDevice* device) {
+    int rc = LIBUSB_SUCCESS;
+    int i;
+    int pendingCount;
+    int retries;
+
+    // Cancel all in-flight sends. Their callbacks report the cancellation.
+    // A transfer that is already completing may refuse the cancel, but its
+    // callback is still pending, so wait on sendInFlight_ either way.
+    for (i = 0; i < FREESPACE_SEND_POOL_SIZE; i++) {
+        struct FreespaceSendTransfer* st = &device->sendPool_[i];
+        if (st->transfer_ != NULL && st->submitted_) {
+            libusb_cancel_transfer(st->transfer_);
+        }
+    }
+
+    // Wait for the cancellations to complete before the transfers are freed.
+    pendingCount = device->sendInFlight_;
+    retries = pendingCount * 3;
+    while (pendingCount > 0 && retries > 0) {
+        struct timeval tv;
+
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+
+        rc = libusb_handle_events_timeout(freespace_libusb_context, &tv);
+        if (rc != LIBUSB_SUCCESS) {
+            break;
+        }
+
+        pendingCount = device->sendInFlight_;
+        retries--;
+    }
+
+    for (i = 0; i < FREESPACE_SEND_POOL_SIZE; i++) {
+        struct FreespaceSendTransfer* st = &device->sendPool_[i];
+        if (st->transfer_ != NULL) {
+            if (st->submitted_) {
+                // Still in flight after the wait. Freeing it now would leave
+                // libusb with a dangling transfer, so let its callback free it.
+                st->transfer_->callback = orphanedSendCallback;
+                st->transfer_->user_data = NULL;
+            } else {
+                libusb_free_transfer(st->transfer_);
+            }
+            st->transfer_ = NULL;
+        }
+        st->submitted_ = 0;
+    }
+    device->sendFreeList_ = NULL;
+    device->sendInFlight_ = 0;
+
+    return libusb_to_freespace_error(rc);
+}
+
+int freespace_openDevice(FreespaceDeviceId id) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    struct libusb_config_descriptor *config;
+    const struct libusb_interface_descriptor* intd;
+    int controlInterfaceNumber;
+    int i;
+    int rc;
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    rc = libusb_open(device->dev_, &device->handle_);
+    if (rc != LIBUSB_SUCCESS) {
+        return libusb_to_freespace_error(rc);
+    }
+
+    controlInterfaceNumber = device->api_->controlInterfaceNumber_;
+    rc = libusb_kernel_driver_active(device->handle_, controlInterfaceNumber);
+    if (rc == 1) {
     	// Kernel driver attached.  Disconnect it.
     	rc = libusb_detach_kernel_driver(device->handle_, controlInterfaceNumber);
     	if (rc == LIBUSB_SUCCESS) {
@@ -563,6 +1235,12 @@ int freespace_openDevice(FreespaceDeviceId id) {
 
     device->state_ = FREESPACE_OPENED;
 
+    rc = freespace_initiateSendPool(device);
+    if (rc != FREESPACE_SUCCESS) {
+        freespace_terminateSendPool(device);
+        return rc;
+    }
+
     // Start the receive queue working.
     rc = freespace_initiateReceiveTransfers(device);
     return rc;
@@ -572,8 +1250,9 @@ void freespace_closeDevice(FreespaceDeviceId id) {
     struct FreespaceDevice* device;
     device = findDeviceById(id);
     if (device != NULL && device->handle_ != NULL) {
-        // Stop receives.
+        // Stop receives and any asynchronous sends still in flight.
         freespace_terminateReceiveTransfers(device);
+        freespace_terminateSendPool(device);
 
         // Should we wait until everything terminates cleanly?
 
@@ -597,11 +1276,39 @@ void freespace_closeDevice(FreespaceDeviceId id) {
     }
 }
 
+#ifndef __APPLE__
+struct SyncSendResult {
+    int done_;
+    int rc_;
+};
+
+static void syncSendCallback(FreespaceDeviceId id, void* cookie, int result) {
+    struct SyncSendResult* r = (struct SyncSendResult*) cookie;
+    r->rc_ = result;
+    r->done_ = 1;
+}
+
+// Return the number of milliseconds of timeoutMs left since start.
+static unsigned int remainingMs(const struct timeval* start, unsigned int timeoutMs) {
+    struct timeval now;
+    long elapsedMs;
+
+    gettimeofday(&now, NULL);
+    elapsedMs = (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+    if (elapsedMs < 0) {
+        return timeoutMs;
+    }
+    if (elapsedMs >= (long) timeoutMs) {
+        return 0;
+    }
+    return timeoutMs - (unsigned int) elapsedMs;
+}
+#endif
+
 int freespace_private_send(FreespaceDeviceId id,
                            const uint8_t* message,
                            int length) {
     int rc;
-    int count;
     struct FreespaceDevice* device;
     device = findDeviceById(id);
 
@@ -609,40 +1316,107 @@ int freespace_private_send(FreespaceDeviceId id,
         return FREESPACE_ERROR_NOT_FOUND;
     }
 
-    if (length > device->maxWriteSize_) {
+    if (length > device->maxWriteSize_ || length > FREESPACE_MAX_OUTPUT_MESSAGE_SIZE) {
         // Can't write more than the max allowed size, so fail rather than send a partial packet.
         return FREESPACE_ERROR_SEND_TOO_LARGE;
     }
 
-    rc = libusb_interrupt_transfer(device->handle_, device->writeEndpointAddress_, (unsigned char*) message, length, &count, 0);
-    if (rc != LIBUSB_SUCCESS) {
-        return libusb_to_freespace_error(rc);
-    }
-    if (length != count) {
-        // libusb should never fragment the message.
-        return FREESPACE_ERROR_UNEXPECTED;
+#ifdef __APPLE__
+    {
+        int count;
+        rc = libusb_interrupt_transfer(device->handle_, device->writeEndpointAddress_, (unsigned char*) message, length, &count, device->sendTimeoutMs_);
+        if (rc != LIBUSB_SUCCESS) {
+            return libusb_to_freespace_error(rc);
+        }
+        if (length != count) {
+            // libusb should never fragment the message.
+            return FREESPACE_ERROR_UNEXPECTED;
+        }
     }
 
     return FREESPACE_SUCCESS;
+#else
+    {
+        struct FreespaceSendTransfer* st;
+        struct SyncSendResult result;
+        struct timeval start;
+        struct timeval tv;
+        unsigned int left;
+        int retries;
+        int error;
+
+        // Synchronous sends go through the outbound pipeline so that they
+        // stay in order behind any asynchronous sends already in flight.
+        gettimeofday(&start, NULL);
+        while ((st = acquireSendTransfer(device)) == NULL) {
+            left = remainingMs(&start, device->sendTimeoutMs_);
+            if (left == 0) {
+                return FREESPACE_ERROR_TIMEOUT;
+            }
+            tv.tv_sec = left / 1000;
+            tv.tv_usec = (left % 1000) * 1000;
+            rc = libusb_handle_events_timeout(freespace_libusb_context, &tv);
+            if (rc != LIBUSB_SUCCESS) {
+                return libusb_to_freespace_error(rc);
+            }
+        }
+
+        left = remainingMs(&start, device->sendTimeoutMs_);
+        if (left == 0) {
+            releaseSendTransfer(st);
+            return FREESPACE_ERROR_TIMEOUT;
+        }
+
+        result.done_ = 0;
+        result.rc_ = FREESPACE_SUCCESS;
+        rc = submitSendTransfer(device, st, message, length, left, syncSendCallback, &result);
+        if (rc != FREESPACE_SUCCESS) {
+            return rc;
+        }
+
+        // libusb enforces the timeout on the transfer itself, so this loop
+        // normally ends with the callback. If event handling fails, cancel
+        // the transfer and give the cancellation a bounded number of tries.
+        retries = -1;
+        while (!result.done_) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 100000;
+            rc = libusb_handle_events_timeout(freespace_libusb_context, &tv);
+            if (retries < 0) {
+                if (rc != LIBUSB_SUCCESS) {
+                    libusb_cancel_transfer(st->transfer_);
+                    retries = 3;
+                    error = libusb_to_freespace_error(rc);
+                }
+            } else if (retries-- == 0) {
+                // The callback writes to result, which is about to go out
+                // of scope, so orphan the transfer instead.
+                orphanSendTransfer(st);
+                return error;
+            }
+        }
+
+        return result.rc_;
+    }
+#endif
 }
 
 int freespace_sendMessage(FreespaceDeviceId id,
                           struct freespace_message* message) {
     int rc;
     uint8_t msgBuf[FREESPACE_MAX_OUTPUT_MESSAGE_SIZE];
-    struct FreespaceDeviceInfo info;
+    struct FreespaceDevice* device = findDeviceById(id);
     
     // Address is reserved for now and must be set to 0 by the caller.
     if (message->dest == 0) {
         message->dest = FREESPACE_RESERVED_ADDRESS;
     }
 
-    rc = freespace_getDeviceInfo(id, &info);
-    if (rc != FREESPACE_SUCCESS) {
-        return rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
     }
     
-    message->ver = info.hVer;
+    message->ver = device->api_->hVer_;
     rc = freespace_encode_message(message, msgBuf, FREESPACE_MAX_OUTPUT_MESSAGE_SIZE);
     if (rc <= FREESPACE_SUCCESS) {
         return rc;
@@ -651,26 +1425,35 @@ int freespace_sendMessage(FreespaceDeviceId id,
     return freespace_private_send(id, msgBuf, rc);
 }
 
-int freespace_private_read(FreespaceDeviceId id,
-                           uint8_t* message,
-                           int maxLength,
-                           unsigned int timeoutMs,
-                           int* actualLength) {
-    struct FreespaceDevice* device = findDeviceById(id);
+// Wait for the report at the head of the receive queue. On success,
+// *rtOut is the completed entry, which the caller consumes, resubmits and
+// then advances past.
+static int waitForReceive(struct FreespaceDevice* device,
+                          unsigned int timeoutMs,
+                          struct FreespaceReceiveTransfer** rtOut) {
     struct FreespaceReceiveTransfer* rt;
+    struct FreespaceReceiveTransfer* tail;
     int rc;
+    int failures;
+    int i;
 
-    if (device == NULL || device->state_ != FREESPACE_OPENED) {
-        return FREESPACE_ERROR_NOT_FOUND;
-    }
+    rt = &device->receiveQueue_[device->receiveQueueHead_];
 
-    if (maxLength < device->maxReadSize_) {
-        // Don't risk causing an overflow due to too small
-        // a receive buffer.
-        return FREESPACE_ERROR_RECEIVE_BUFFER_TOO_SMALL;
-    }
+    // Retry receives that could not be resubmitted earlier. A stale entry
+    // holds nothing to read, and once resubmitted it is the newest
+    // transfer, so move the head past it to keep it at the tail of the
+    // ring. Entries behind it were submitted earlier and are read first.
+    for (failures = 0; rt->stale_; ) {
+        rc = recycleReceiveTransfer(device, rt);
+        failures = (rc == FREESPACE_SUCCESS) ? 0 : failures + 1;
+        advanceReceiveQueue(device);
+        rt = &device->receiveQueue_[device->receiveQueueHead_];
 
-    rt = &device->receiveQueue_[device->receiveQueueHead_];
+        // Give up once a full lap of resubmits has failed.
+        if (failures >= device->receiveQueueDepth_) {
+            return rc;
+        }
+    }
 
     // Check if we need to wait.
     if (rt->submitted_ != 0) {
@@ -701,39 +1484,176 @@ int freespace_private_read(FreespaceDeviceId id,
         }
     }
 
+    // Transfers complete in submission order, so if the most recently
+    // submitted one is done too, then every entry holds an unread report
+    // and the device has nowhere to put the next one. Stale entries are
+    // not submitted and retired ones are gone, so the most recent one is the
+    // last entry that is neither.
+    tail = rt;
+    for (i = device->receiveQueueDepth_ - 1; i > 0; i--) {
+        struct FreespaceReceiveTransfer* entry = &device->receiveQueue_[(device->receiveQueueHead_ + i) % device->receiveQueueDepth_];
+        if (!entry->stale_ && entry->transfer_ != NULL) {
+            tail = entry;
+            break;
+        }
+    }
+    if (tail->submitted_ == 0) {
+        device->receiveQueueFullCount_++;
+        device->receiveQueueQuietReads_ = 0;
+        if ((device->receiveQueueFlags_ & FREESPACE_RECEIVE_QUEUE_ADAPTIVE) &&
+            device->receiveQueueTargetDepth_ < device->receiveQueueCapacity_) {
+            device->receiveQueueTargetDepth_ *= 2;
+            if (device->receiveQueueTargetDepth_ > device->receiveQueueCapacity_) {
+                device->receiveQueueTargetDepth_ = device->receiveQueueCapacity_;
+            }
+        }
+    } else if (device->receiveQueueQuietReads_ < FREESPACE_RECEIVE_QUEUE_SHRINK_READS) {
+        device->receiveQueueQuietReads_++;
+    }
+
+    *rtOut = rt;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_private_read(FreespaceDeviceId id,
+                           uint8_t* message,
+                           int maxLength,
+                           unsigned int timeoutMs,
+                           int* actualLength) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    struct FreespaceReceiveTransfer* rt;
+    int rc;
+
+    if (device == NULL || device->state_ != FREESPACE_OPENED) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    if (maxLength < device->maxReadSize_) {
+        // Don't risk causing an overflow due to too small
+        // a receive buffer.
+        return FREESPACE_ERROR_RECEIVE_BUFFER_TOO_SMALL;
+    }
+
+    rc = waitForReceive(device, timeoutMs, &rt);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
     // Copy the message out.
     *actualLength = rt->transfer_->actual_length;
     memcpy(message, rt->buffer_, *actualLength);
     rc = libusb_transfer_status_to_freespace_error(rt->transfer_->status);
 
-    // Resubmit the transfer
-    rt->submitted_ = 1;
-    libusb_submit_transfer(rt->transfer_);
-    device->receiveQueueHead_++;
-    if (device->receiveQueueHead_ >= FREESPACE_RECEIVE_QUEUE_SIZE) {
-        device->receiveQueueHead_ = 0;
+    // Resubmit the transfer. A failure is retried on the next read.
+    recycleReceiveTransfer(device, rt);
+    advanceReceiveQueue(device);
+
+    return rc;
+}
+
+int freespace_borrowReport(FreespaceDeviceId id,
+                           unsigned int timeoutMs,
+                           struct FreespaceReportBuffer* report) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    struct FreespaceReceiveTransfer* rt;
+    int rc;
+
+    if (device == NULL || device->state_ != FREESPACE_OPENED) {
+        return FREESPACE_ERROR_NOT_FOUND;
     }
 
+    // A spare buffer has to take the place of the lent one.
+    if (device->receiveSpareCount_ == 0) {
+        return FREESPACE_ERROR_BUSY;
+    }
+
+    rc = waitForReceive(device, timeoutMs, &rt);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    report->data = rt->buffer_;
+    report->length = rt->transfer_->actual_length;
+    device->receiveLent_[device->receiveLentCount_++] = rt->buffer_;
+    rc = libusb_transfer_status_to_freespace_error(rt->transfer_->status);
+
+    // Resubmit with a spare buffer so that the queue keeps its order.
+    rt->buffer_ = device->receiveSpares_[--device->receiveSpareCount_];
+    rt->transfer_->buffer = rt->buffer_;
+    recycleReceiveTransfer(device, rt);
+    advanceReceiveQueue(device);
+
     return rc;
 }
 
+// Remove data from the buffers lent out by freespace_borrowReport(). Returns
+// 0 if it is not one of them, which catches double releases and foreign
+// pointers before they are reused as receive buffers.
+static int takeLentReport(struct FreespaceDevice* device, uint8_t* data) {
+    int i;
+    for (i = 0; i < device->receiveLentCount_; i++) {
+        if (device->receiveLent_[i] == data) {
+            device->receiveLent_[i] = device->receiveLent_[--device->receiveLentCount_];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int freespace_releaseReport(FreespaceDeviceId id,
+                            struct FreespaceReportBuffer* report) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL || device->state_ != FREESPACE_OPENED) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+    if (report->data == NULL || !takeLentReport(device, report->data)) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    device->receiveSpares_[device->receiveSpareCount_++] = report->data;
+    report->data = NULL;
+    report->length = 0;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_addReceiveBuffers(FreespaceDeviceId id,
+                                uint8_t* buffers,
+                                int count) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    int i;
+
+    if (device == NULL || device->state_ != FREESPACE_OPENED) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+    if (buffers == NULL || count < 0 ||
+        device->receiveRegisteredCount_ + count > FREESPACE_RECEIVE_BUFFERS_MAX) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    for (i = 0; i < count; i++) {
+        device->receiveSpares_[device->receiveSpareCount_++] = buffers + i * FREESPACE_MAX_INPUT_MESSAGE_SIZE;
+    }
+    device->receiveRegisteredCount_ += count;
+    return FREESPACE_SUCCESS;
+}
+
 int freespace_readMessage(FreespaceDeviceId id,
                           struct freespace_message* message,
                           unsigned int timeoutMs) {
     int rc;
     uint8_t buffer[FREESPACE_MAX_INPUT_MESSAGE_SIZE];
     int actLen;
-    struct FreespaceDeviceInfo info;
+    struct FreespaceDevice* device = findDeviceById(id);
     
-    rc = freespace_getDeviceInfo(id, &info);
-    if (rc != FREESPACE_SUCCESS) {
-        return rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
     }
     
     rc = freespace_private_read(id, buffer, sizeof(buffer), timeoutMs, &actLen);
     
     if (rc == FREESPACE_SUCCESS) {
-        return freespace_decode_message(buffer, actLen, message, info.hVer);
+        return freespace_decode_message(buffer, actLen, message, device->api_->hVer_);
     } else {
         return rc;
     }
@@ -744,11 +1664,12 @@ int freespace_flush(FreespaceDeviceId id) {
     struct FreespaceReceiveTransfer* rt;
     struct timeval tv;
     int repeat;
-    int maxRepeats = FREESPACE_RECEIVE_QUEUE_SIZE * 2;
+    int maxRepeats;
 
     if (device == NULL || device->state_ != FREESPACE_OPENED) {
         return FREESPACE_ERROR_NOT_FOUND;
     }
+    maxRepeats = device->receiveQueueCapacity_ * 2;
 
 
     // As long as there's work, try again.
@@ -764,12 +1685,10 @@ int freespace_flush(FreespaceDeviceId id) {
         // Clear out our queue.
         rt = &device->receiveQueue_[device->receiveQueueHead_];
         while (rt->submitted_ == 0) {
-            rt->submitted_ = 1;
-            libusb_submit_transfer(rt->transfer_);
-            device->receiveQueueHead_++;
-            if (device->receiveQueueHead_ >= FREESPACE_RECEIVE_QUEUE_SIZE) {
-                device->receiveQueueHead_ = 0;
+            if (recycleReceiveTransfer(device, rt) != FREESPACE_SUCCESS) {
+                break;
             }
+            advanceReceiveQueue(device);
 
             rt = &device->receiveQueue_[device->receiveQueueHead_];
             repeat = 1;
@@ -781,20 +1700,6 @@ int freespace_flush(FreespaceDeviceId id) {
     return FREESPACE_SUCCESS;
 }
 
-struct SendTransferInfo {
-    FreespaceDeviceId id;
-    freespace_sendCallback callback;
-    void* cookie;
-};
-
-static void sendCallback(struct libusb_transfer* transfer) {
-    struct SendTransferInfo* info = (struct SendTransferInfo*) transfer->user_data;
-    int rc = libusb_transfer_status_to_freespace_error(transfer->status);
-    info->callback(info->id, info->cookie, rc);
-
-    free(info);
-}
-
 int freespace_private_sendAsync(FreespaceDeviceId id,
                                 const uint8_t* message,
                                 int length,
@@ -814,49 +1719,23 @@ int freespace_private_sendAsync(FreespaceDeviceId id,
 #else
     struct FreespaceDevice* device;
     device = findDeviceById(id);
-    struct libusb_transfer* transfer;
-    int rc;
+    struct FreespaceSendTransfer* st;
 
     if (device == NULL || device->state_ != FREESPACE_OPENED) {
         return FREESPACE_ERROR_NOT_FOUND;
     }
 
-    if (length > device->maxWriteSize_) {
+    if (length > device->maxWriteSize_ || length > FREESPACE_MAX_OUTPUT_MESSAGE_SIZE) {
         return FREESPACE_ERROR_SEND_TOO_LARGE;
     }
 
-    transfer = libusb_alloc_transfer(0);
-    if (transfer == NULL) {
-        return FREESPACE_ERROR_OUT_OF_MEMORY;
-    }
-
-    transfer->dev_handle = device->handle_;
-    transfer->endpoint = device->writeEndpointAddress_;
-    transfer->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
-    transfer->timeout = timeoutMs;
-    transfer->buffer = (unsigned char*) message;
-    transfer->length = length;
-    transfer->flags = LIBUSB_TRANSFER_FREE_TRANSFER;
-
-    if (callback != NULL) {
-        struct SendTransferInfo* info = (struct SendTransferInfo*) malloc(sizeof(struct SendTransferInfo));
-    	if (info == NULL) {
-    	    libusb_free_transfer(transfer);
-            return FREESPACE_ERROR_OUT_OF_MEMORY;
-    	}
-    	info->id = id;
-        info->callback = callback;
-        info->cookie = cookie;
-    	transfer->callback = sendCallback;
-    	transfer->user_data = info;
-    } else {
-    	transfer->callback = NULL;
-    	transfer->user_data = NULL;
+    // Apply backpressure rather than queueing without bound.
+    st = acquireSendTransfer(device);
+    if (st == NULL) {
+        return FREESPACE_ERROR_BUSY;
     }
 
-    rc = libusb_submit_transfer(transfer);
-
-    return libusb_to_freespace_error(rc);
+    return submitSendTransfer(device, st, message, length, timeoutMs, callback, cookie);
 #endif
 }
 
@@ -868,19 +1747,18 @@ int freespace_sendMessageAsync(FreespaceDeviceId id,
 
     int rc;
     uint8_t msgBuf[FREESPACE_MAX_OUTPUT_MESSAGE_SIZE];
-    struct FreespaceDeviceInfo info;
+    struct FreespaceDevice* device = findDeviceById(id);
     
     // Address is reserved for now and must be set to 0 by the caller.
     if (message->dest == 0) {
         message->dest = FREESPACE_RESERVED_ADDRESS;
     }
     
-    rc = freespace_getDeviceInfo(id, &info);
-    if (rc != FREESPACE_SUCCESS) {
-        return rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
     }
     
-    message->ver = info.hVer;
+    message->ver = device->api_->hVer_;
     rc = freespace_encode_message(message, msgBuf, FREESPACE_MAX_OUTPUT_MESSAGE_SIZE);
     if (rc <= FREESPACE_SUCCESS) {
         return rc;
@@ -891,7 +1769,7 @@ int freespace_sendMessageAsync(FreespaceDeviceId id,
 
 int freespace_getNextTimeout(int* timeoutMsOut) {
     struct timeval tv;
-    int hotplugTimeout = freespace_hotplug_timeout();
+    int hotplugTimeout = useLibusbHotplug ? -1 : freespace_hotplug_timeout();
     int timeoutMs;
 
     int rc = libusb_get_next_timeout(freespace_libusb_context, &tv);
@@ -909,6 +1787,12 @@ int freespace_getNextTimeout(int* timeoutMsOut) {
         // No one has a timeout.
         timeoutMs = -1;
     }
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+    if (libusbHotplugEventCount > 0 || libusbHotplugOverflow) {
+        // Queued hotplug events are waiting for freespace_perform().
+        timeoutMs = 0;
+    }
+#endif
     *timeoutMsOut = timeoutMs;
     return libusb_to_freespace_error(rc);
 }
@@ -916,10 +1800,24 @@ int freespace_getNextTimeout(int* timeoutMsOut) {
 int freespace_perform() {
     struct timeval tv = {0, 0};
     int rc;
+    int i;
 
     scanDevices();
 
+    // Retry receives whose resubmit failed in the receive callback.
+    for (i = 0; i < FREESPACE_MAXIMUM_DEVICE_COUNT; i++) {
+        if (devices[i] != NULL && devices[i]->state_ == FREESPACE_OPENED) {
+            resubmitStaleTransfers(devices[i]);
+        }
+    }
+
     rc = libusb_handle_events_timeout(freespace_libusb_context, &tv);
+#ifdef FREESPACE_LIBUSB_HOTPLUG
+    // Deliver the hotplug events that were just reported.
+    if (useLibusbHotplug && libusbHotplugRegistered) {
+        deliverLibusbHotplugEvents();
+    }
+#endif
     return libusb_to_freespace_error(rc);
 }
 
@@ -950,8 +1848,11 @@ int freespace_syncFileDescriptors() {
         return FREESPACE_SUCCESS;
     }
 
-    // Add the hotplug code's fd
-    userAddedCallback(freespace_hotplug_getFD(), POLLIN);
+    // Add the hotplug code's fd. libusb's own hotplug support
+    // uses one of its pollfds below.
+    if (!useLibusbHotplug) {
+        userAddedCallback(freespace_hotplug_getFD(), POLLIN);
+    }
 
     // Add all of libusb's handles
     usbfds = libusb_get_pollfds(freespace_libusb_context);
@@ -973,7 +1874,7 @@ int freespace_private_setReceiveCallback(FreespaceDeviceId id,
         return FREESPACE_ERROR_NOT_FOUND;
     }
 
-    wereInSyncMode = (device->receiveCallback_ == NULL && device->receiveMessageCallback_ == NULL);
+    wereInSyncMode = !isAsyncReceive(device);
     device->receiveCallback_ = callback;
     device->receiveCookie_ = cookie;
 
@@ -984,18 +1885,18 @@ int freespace_private_setReceiveCallback(FreespaceDeviceId id,
         struct FreespaceReceiveTransfer* rt;
         rt = &device->receiveQueue_[device->receiveQueueHead_];
         while (rt->submitted_ == 0) {
-            callback(device->id_,
-                     (const uint8_t*) rt->buffer_,
-                     rt->transfer_->actual_length,
-                     cookie,
-                     libusb_transfer_status_to_freespace_error(rt->transfer_->status));
-
-            rt->submitted_ = 1;
-            libusb_submit_transfer(rt->transfer_);
-            device->receiveQueueHead_++;
-            if (device->receiveQueueHead_ >= FREESPACE_RECEIVE_QUEUE_SIZE) {
-                device->receiveQueueHead_ = 0;
+            if (!rt->stale_) {
+                callback(device->id_,
+                         (const uint8_t*) rt->buffer_,
+                         rt->transfer_->actual_length,
+                         cookie,
+                         libusb_transfer_status_to_freespace_error(rt->transfer_->status));
+            }
+
+            if (recycleReceiveTransfer(device, rt) != FREESPACE_SUCCESS) {
+                break;
             }
+            advanceReceiveQueue(device);
 
             rt = &device->receiveQueue_[device->receiveQueueHead_];
         }
@@ -1003,53 +1904,265 @@ int freespace_private_setReceiveCallback(FreespaceDeviceId id,
     return FREESPACE_SUCCESS;
 }
 
+// Run the message callbacks on all reports queued while in sync mode.
+static void routeReceiveQueue(struct FreespaceDevice* device) {
+    struct FreespaceReceiveTransfer* rt;
+    rt = &device->receiveQueue_[device->receiveQueueHead_];
+    while (rt->submitted_ == 0) {
+        if (!rt->stale_) {
+            freespace_private_routeMessage(&device->router_, device->id_,
+                                           (const uint8_t*) rt->buffer_, rt->transfer_->actual_length, device->api_->hVer_,
+                                           device->receiveMessageCallback_, device->receiveMessageCookie_);
+        }
+
+        if (recycleReceiveTransfer(device, rt) != FREESPACE_SUCCESS) {
+            break;
+        }
+        advanceReceiveQueue(device);
+
+        rt = &device->receiveQueue_[device->receiveQueueHead_];
+    }
+}
+
 int freespace_setReceiveMessageCallback(FreespaceDeviceId id,
                                         freespace_receiveMessageCallback callback,
                                         void* cookie) {
     struct FreespaceDevice* device = findDeviceById(id);
     int wereInSyncMode;
-    int rc;
 
     if (device == NULL) {
         return FREESPACE_ERROR_NOT_FOUND;
     }
 
-    wereInSyncMode = (device->receiveMessageCallback_ == NULL && device->receiveCallback_ == NULL);
+    wereInSyncMode = !isAsyncReceive(device);
     device->receiveMessageCallback_ = callback;
     device->receiveMessageCookie_ = cookie;
 
     if (callback != NULL && wereInSyncMode && device->state_ == FREESPACE_OPENED) {
-        struct freespace_message m;
-        
         // Transition from sync mode to async mode.
+        routeReceiveQueue(device);
+    }
+    return FREESPACE_SUCCESS;
+}
 
-        // Need to run the callback on all received messages.
-        struct FreespaceReceiveTransfer* rt;
-        rt = &device->receiveQueue_[device->receiveQueueHead_];
-        while (rt->submitted_ == 0) {
-            rc = freespace_decode_message((const uint8_t*) rt->buffer_, rt->transfer_->actual_length, &m, device->api_->hVer_);
-            if (rc == FREESPACE_SUCCESS) {
-                callback(device->id_,
-                         &m,
-                         cookie,
-                         libusb_transfer_status_to_freespace_error(rt->transfer_->status));
-            } else {
-                callback(device->id_,
-                         NULL,
-                         cookie,
-                         rc);
-            }
+int freespace_setMessageFilter(FreespaceDeviceId id,
+                               const struct FreespaceMessageMask* mask) {
+    struct FreespaceDevice* device = findDeviceById(id);
 
-            rt->submitted_ = 1;
-            libusb_submit_transfer(rt->transfer_);
-            device->receiveQueueHead_++;
-            if (device->receiveQueueHead_ >= FREESPACE_RECEIVE_QUEUE_SIZE) {
-                device->receiveQueueHead_ = 0;
-            }
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
 
-            rt = &device->receiveQueue_[device->receiveQueueHead_];
-        }
+    freespace_private_setMessageFilter(&device->router_, mask);
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_setMessageTypeCallback(FreespaceDeviceId id,
+                                     int messageType,
+                                     freespace_receiveMessageCallback callback,
+                                     void* cookie) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    int wereInSyncMode;
+    int rc;
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    wereInSyncMode = !isAsyncReceive(device);
+    rc = freespace_private_setMessageTypeCallback(&device->router_, messageType, callback, cookie);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    if (callback != NULL && wereInSyncMode && device->state_ == FREESPACE_OPENED) {
+        // Transition from sync mode to async mode.
+        routeReceiveQueue(device);
+    }
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_subscribe(FreespaceDeviceId id,
+                        const struct FreespaceMessageMask* mask,
+                        freespace_subscriberCallback callback,
+                        void* cookie) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    int wereInSyncMode;
+    int rc;
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    wereInSyncMode = !isAsyncReceive(device);
+    rc = freespace_private_subscribe(&device->router_, mask, callback, cookie);
+    if (rc >= 0 && wereInSyncMode && device->state_ == FREESPACE_OPENED) {
+        // Transition from sync mode to async mode.
+        routeReceiveQueue(device);
     }
+    return rc;
+}
+
+int freespace_subscribeQueue(FreespaceDeviceId id,
+                             const struct FreespaceMessageMask* mask,
+                             int depth) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    int wereInSyncMode;
+    int rc;
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    wereInSyncMode = !isAsyncReceive(device);
+    rc = freespace_private_subscribeQueue(&device->router_, mask, depth);
+    if (rc >= 0 && wereInSyncMode && device->state_ == FREESPACE_OPENED) {
+        // Transition from sync mode to async mode.
+        routeReceiveQueue(device);
+    }
+    return rc;
+}
+
+int freespace_unsubscribe(FreespaceDeviceId id, int subscription) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_unsubscribe(&device->router_, subscription);
+}
+
+int freespace_popMessage(FreespaceDeviceId id,
+                         int subscription,
+                         const struct freespace_message** message) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_popMessage(&device->router_, subscription, message);
+}
+
+int freespace_getDroppedMessages(FreespaceDeviceId id,
+                                 int subscription,
+                                 uint32_t* dropped) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_getDroppedMessages(&device->router_, subscription, dropped);
+}
+
+int freespace_drainMessages(FreespaceDeviceId id,
+                            int subscription,
+                            freespace_subscriberCallback callback,
+                            void* cookie) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_drainMessages(&device->router_, id, subscription, callback, cookie);
+}
+
+int freespace_acquireMessage(FreespaceDeviceId id,
+                             const struct freespace_message* message) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_acquireMessage(&device->router_, message);
+}
+
+int freespace_releaseMessage(FreespaceDeviceId id,
+                             const struct freespace_message* message) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    return freespace_private_releaseMessage(&device->router_, message);
+}
+
+int freespace_setReceiveQueueSize(FreespaceDeviceId id, int size, int flags) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    if (size < 0 || size > FREESPACE_RECEIVE_QUEUE_SIZE_MAX) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    if (flags & ~FREESPACE_RECEIVE_QUEUE_ADAPTIVE) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    device->receiveQueueSize_ = size;
+    device->receiveQueueFlags_ = flags;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_getReceiveStats(FreespaceDeviceId id, struct FreespaceReceiveStats* stats) {
+    struct FreespaceDevice* device = findDeviceById(id);
+
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    stats->queueDepth = device->receiveQueueDepth_;
+    stats->queueFullCount = device->receiveQueueFullCount_;
+    stats->resubmitFailureCount = device->receiveResubmitFailureCount_;
     return FREESPACE_SUCCESS;
 }
 
+int freespace_setSendPipelineDepth(FreespaceDeviceId id, int depth) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+    if (depth < 0 || depth > FREESPACE_SEND_PIPELINE_DEPTH_MAX) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    // Lowering the depth lets transfers already in flight complete.
+    device->sendDepth_ = depth > 0 ? depth : FREESPACE_SEND_POOL_SIZE;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_setSendTimeout(FreespaceDeviceId id, unsigned int timeoutMs) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    device->sendTimeoutMs_ = timeoutMs > 0 ? timeoutMs : FREESPACE_SEND_TIMEOUT_MS;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_cancelSends(FreespaceDeviceId id) {
+    struct FreespaceDevice* device = findDeviceById(id);
+    int i;
+
+    if (device == NULL || device->state_ != FREESPACE_OPENED) {
+        return FREESPACE_ERROR_NOT_FOUND;
+    }
+
+    // Completion callbacks report FREESPACE_ERROR_INTERRUPTED.
+    for (i = 0; i < FREESPACE_SEND_POOL_SIZE; i++) {
+        struct FreespaceSendTransfer* st = &device->sendPool_[i];
+        if (st->submitted_) {
+            libusb_cancel_transfer(st->transfer_);
+        }
+    }
+    return FREESPACE_SUCCESS;
+}
@@ -21,6 +21,7 @@
 #include "freespace/freespace.h"
 #include "freespace/freespace_deviceTable.h"
 #include "freespace_config.h"
+#include "freespace_router.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -69,6 +70,9 @@
 #define TRACE(...)
 #endif
 
+#define FREESPACE_RECEIVE_LEND_SPARES 4 // Internal buffers for freespace_borrowReport().
+#define FREESPACE_RECEIVE_SPARE_MAX (FREESPACE_RECEIVE_BUFFERS_MAX + FREESPACE_RECEIVE_LEND_SPARES)
+
 /**
  * The device state is primarily used to keep track of FreespaceDevice allocations.
  * The state machine looks like the following:
@@ -107,6 +111,17 @@ struct FreespaceDevice {
     freespace_receiveMessageCallback receiveMessageCallback_;
     void* receiveCookie_;
     void* receiveMessageCookie_;
+    struct FreespaceMessageRouter router_;
+
+    // Buffers free for freespace_borrowReport() to read into.
+    uint8_t lendStorage_[FREESPACE_RECEIVE_LEND_SPARES * FREESPACE_MAX_INPUT_MESSAGE_SIZE];
+    uint8_t* receiveSpares_[FREESPACE_RECEIVE_SPARE_MAX];
+    int receiveSpareCount_;
+    int receiveRegisteredCount_;
+
+    // Buffers currently lent out, so that releases can be checked.
+    uint8_t* receiveLent_[FREESPACE_RECEIVE_SPARE_MAX];
+    int receiveLentCount_;
 };
 
 #define DEV_DIR "/dev/"
@@ -333,6 +348,14 @@ int freespace_openDevice(FreespaceDeviceId id) {
     uint8_t buf[1024];
     while (read(device->fd_, buf, sizeof(buf)) > 0);
 
+    int i;
+    device->receiveSpareCount_ = 0;
+    device->receiveRegisteredCount_ = 0;
+    device->receiveLentCount_ = 0;
+    for (i = 0; i < FREESPACE_RECEIVE_LEND_SPARES; i++) {
+        device->receiveSpares_[device->receiveSpareCount_++] = device->lendStorage_ + i * FREESPACE_MAX_INPUT_MESSAGE_SIZE;
+    }
+
     if (userAddedCallback) {
         userAddedCallback(device->fd_, POLLIN);
     }
@@ -426,6 +449,99 @@ int freespace_readMessage(FreespaceDeviceId id,
 
 }
 
+int freespace_borrowReport(FreespaceDeviceId id,
+                           unsigned int timeoutMs,
+                           struct FreespaceReportBuffer* report) {
+    struct pollfd pfd;
+    uint8_t* buf;
+    ssize_t rc;
+    GET_DEVICE_IF_OPEN(id, device);
+
+    if (device->receiveSpareCount_ == 0) {
+        return FREESPACE_ERROR_BUSY;
+    }
+
+    pfd.fd = device->fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    rc = poll(&pfd, 1, timeoutMs);
+    if (rc == 0) {
+        return FREESPACE_ERROR_TIMEOUT;
+    }
+    if (rc < 0) {
+        return errno == EINTR ? FREESPACE_ERROR_INTERRUPTED : FREESPACE_ERROR_IO;
+    }
+
+    // Read straight into the buffer that is lent out.
+    buf = device->receiveSpares_[device->receiveSpareCount_ - 1];
+    rc = read(device->fd_, buf, FREESPACE_MAX_INPUT_MESSAGE_SIZE);
+    if (rc < 0) {
+        if (errno == EAGAIN) {
+            return FREESPACE_ERROR_TIMEOUT;
+        }
+        if (errno == ENOENT || errno == ENODEV) {
+            return FREESPACE_ERROR_NO_DEVICE;
+        }
+        WARN("Failed reading %s: %s", device->hidrawPath_, strerror(errno));
+        return FREESPACE_ERROR_IO;
+    }
+    if (rc == 0) { // EOF
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    device->receiveSpareCount_--;
+    device->receiveLent_[device->receiveLentCount_++] = buf;
+    report->data = buf;
+    report->length = (int) rc;
+    return FREESPACE_SUCCESS;
+}
+
+// Remove data from the buffers lent out by freespace_borrowReport(). Returns
+// 0 if it is not one of them, which catches double releases and foreign
+// pointers before they are reused as receive buffers.
+static int takeLentReport(struct FreespaceDevice* device, uint8_t* data) {
+    int i;
+    for (i = 0; i < device->receiveLentCount_; i++) {
+        if (device->receiveLent_[i] == data) {
+            device->receiveLent_[i] = device->receiveLent_[--device->receiveLentCount_];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int freespace_releaseReport(FreespaceDeviceId id,
+                            struct FreespaceReportBuffer* report) {
+    GET_DEVICE_IF_OPEN(id, device);
+
+    if (report->data == NULL || !takeLentReport(device, report->data)) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    device->receiveSpares_[device->receiveSpareCount_++] = report->data;
+    report->data = NULL;
+    report->length = 0;
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_addReceiveBuffers(FreespaceDeviceId id,
+                                uint8_t* buffers,
+                                int count) {
+    int i;
+    GET_DEVICE_IF_OPEN(id, device);
+
+    if (buffers == NULL || count < 0 ||
+        device->receiveRegisteredCount_ + count > FREESPACE_RECEIVE_BUFFERS_MAX) {
+        return FREESPACE_ERROR_UNEXPECTED;
+    }
+
+    for (i = 0; i < count; i++) {
+        device->receiveSpares_[device->receiveSpareCount_++] = buffers + i * FREESPACE_MAX_INPUT_MESSAGE_SIZE;
+    }
+    device->receiveRegisteredCount_ += count;
+    return FREESPACE_SUCCESS;
+}
+
 int freespace_flush(FreespaceDeviceId id) {
     // TODO
     return FREESPACE_ERROR_UINIMPLEMENTED;
@@ -651,6 +767,112 @@ int freespace_setReceiveMessageCallback(FreespaceDeviceId id,
     return FREESPACE_SUCCESS;
 }
 
+int freespace_setMessageFilter(FreespaceDeviceId id,
+                               const struct FreespaceMessageMask* mask) {
+    GET_DEVICE(id, device);
+
+    freespace_private_setMessageFilter(&device->router_, mask);
+    return FREESPACE_SUCCESS;
+}
+
+int freespace_setMessageTypeCallback(FreespaceDeviceId id,
+                                     int messageType,
+                                     freespace_receiveMessageCallback callback,
+                                     void* cookie) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_setMessageTypeCallback(&device->router_, messageType, callback, cookie);
+}
+
+int freespace_subscribe(FreespaceDeviceId id,
+                        const struct FreespaceMessageMask* mask,
+                        freespace_subscriberCallback callback,
+                        void* cookie) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_subscribe(&device->router_, mask, callback, cookie);
+}
+
+int freespace_subscribeQueue(FreespaceDeviceId id,
+                             const struct FreespaceMessageMask* mask,
+                             int depth) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_subscribeQueue(&device->router_, mask, depth);
+}
+
+int freespace_unsubscribe(FreespaceDeviceId id, int subscription) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_unsubscribe(&device->router_, subscription);
+}
+
+int freespace_popMessage(FreespaceDeviceId id,
+                         int subscription,
+                         const struct freespace_message** message) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_popMessage(&device->router_, subscription, message);
+}
+
+int freespace_getDroppedMessages(FreespaceDeviceId id,
+                                 int subscription,
+                                 uint32_t* dropped) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_getDroppedMessages(&device->router_, subscription, dropped);
+}
+
+int freespace_drainMessages(FreespaceDeviceId id,
+                            int subscription,
+                            freespace_subscriberCallback callback,
+                            void* cookie) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_drainMessages(&device->router_, id, subscription, callback, cookie);
+}
+
+int freespace_acquireMessage(FreespaceDeviceId id,
+                             const struct freespace_message* message) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_acquireMessage(&device->router_, message);
+}
+
+int freespace_releaseMessage(FreespaceDeviceId id,
+                             const struct freespace_message* message) {
+    GET_DEVICE(id, device);
+
+    return freespace_private_releaseMessage(&device->router_, message);
+}
+
+int freespace_setReceiveQueueSize(FreespaceDeviceId id, int size, int flags) {
+    GET_DEVICE(id, device);
+
+    // Reports are queued by the hidraw driver.
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+int freespace_getReceiveStats(FreespaceDeviceId id, struct FreespaceReceiveStats* stats) {
+    GET_DEVICE(id, device);
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+int freespace_setSendPipelineDepth(FreespaceDeviceId id, int depth) {
+    GET_DEVICE(id, device);
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+int freespace_setSendTimeout(FreespaceDeviceId id, unsigned int timeoutMs) {
+    GET_DEVICE(id, device);
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+int freespace_cancelSends(FreespaceDeviceId id) {
+    GET_DEVICE(id, device);
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
 static int _readDevice(struct FreespaceDevice * device) {
     ssize_t rc;
     uint8_t buf[FREESPACE_MAX_OUTPUT_MESSAGE_SIZE];
@@ -681,16 +903,8 @@ static int _readDevice(struct FreespaceDevice * device) {
             device->receiveCallback_(device->id_, buf, (int) rc, device->receiveCookie_, FREESPACE_SUCCESS);
         }
 
-        if (device->receiveMessageCallback_) {
-            struct freespace_message m;
-
-            rc = freespace_decode_message(buf, rc, &m, device->api_->hVer_);
-
-            device->receiveMessageCallback_(
-                    device->id_,
-                    rc == FREESPACE_SUCCESS ? &m : NULL,
-                    device->receiveMessageCookie_, rc);
-        }
+        freespace_private_routeMessage(&device->router_, device->id_, buf, (int) rc, device->api_->hVer_,
+                                       device->receiveMessageCallback_, device->receiveMessageCookie_);
     }
     return FREESPACE_SUCCESS;
 }
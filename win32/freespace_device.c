@@ -192,14 +192,21 @@ struct FreespaceSendStruct* getNextSendBuffer(struct FreespaceDeviceStruct* devi
     return NULL;
 }
 
+// True when any callback wants received reports.
+static int isAsyncReceive(struct FreespaceDeviceStruct* device) {
+    return device->receiveCallback_ != NULL ||
+           device->receiveMessageCallback_ != NULL ||
+           device->router_.typeCallbackCount_ > 0 ||
+           device->router_.subscriberCount_ > 0;
+}
+
 static int initiateAsyncReceives(struct FreespaceDeviceStruct* device) {
     int idx;
     int funcRc = FREESPACE_SUCCESS;
     int rc;
-	struct freespace_message m;
 
     // If no callback or not opened, then don't need to request to receive anything.
-    if (!device->isOpened_ || (device->receiveCallback_ == NULL && device->receiveMessageCallback_ == NULL)) {
+    if (!device->isOpened_ || !isAsyncReceive(device)) {
         return FREESPACE_SUCCESS;
     }
 
@@ -216,19 +223,12 @@ static int initiateAsyncReceives(struct FreespaceDeviceStruct* device) {
 					&s->readOverlapped_ );      /* long pointer to an OVERLAPPED structure */
                 if (bResult) {
                     // Got something, so report it.
-					if (device->receiveCallback_ || device->receiveMessageCallback_) {
+					if (isAsyncReceive(device)) {
 						if (device->receiveCallback_) {
 							device->receiveCallback_(device->id_, (char *) (s->readBuffer), s->readBufferSize, device->receiveCookie_, FREESPACE_SUCCESS);
 						}
-						if (device->receiveMessageCallback_) {
-							rc = freespace_decode_message((char *) (s->readBuffer), s->readBufferSize, &m, device->hVer_);
-							if (rc == FREESPACE_SUCCESS) {
-								device->receiveMessageCallback_(device->id_, &m, device->receiveMessageCookie_, FREESPACE_SUCCESS);
-							} else {
-								device->receiveMessageCallback_(device->id_, NULL, device->receiveMessageCookie_, rc);
-								DEBUG_PRINTF("freespace_decode_message failed with code %d\n", rc);
-							}
-						}
+						freespace_private_routeMessage(&device->router_, device->id_, (uint8_t*) (s->readBuffer), (int) s->readBufferSize, device->hVer_,
+						                               device->receiveMessageCallback_, device->receiveMessageCookie_);
 					} else {
                         // If no receiveCallback, then freespace_setReceiveCallback was called to stop
                         // receives from within the receiveCallback. Bail out to let it do its thing.
@@ -265,8 +265,6 @@ int freespace_private_devicePerform(struct FreespaceDeviceStruct* device) {
     int idx;
     BOOL overlappedResult;
     struct FreespaceSendStruct* send;
-	int rc;
-	struct freespace_message m;
 
     // Handle the send messages
     for (idx = 0; idx < FREESPACE_MAXIMUM_SEND_MESSAGE_COUNT; idx++) {
@@ -316,19 +314,12 @@ int freespace_private_devicePerform(struct FreespaceDeviceStruct* device) {
             lastErr = GetLastError();
             if (bResult) {
                 // Got something, so report it.
-                if (device->receiveCallback_ || device->receiveMessageCallback_) {
+                if (isAsyncReceive(device)) {
 					if (device->receiveCallback_) {
 						device->receiveCallback_(device->id_, (char *) (s->readBuffer), s->readBufferSize, device->receiveCookie_, FREESPACE_SUCCESS);
 					}
-					if (device->receiveMessageCallback_) {
-						rc = freespace_decode_message((char *) (s->readBuffer), s->readBufferSize, &m, device->hVer_);
-						if (rc == FREESPACE_SUCCESS) {
-							device->receiveMessageCallback_(device->id_, &m, device->receiveMessageCookie_, FREESPACE_SUCCESS);
-						} else {
-							device->receiveMessageCallback_(device->id_, NULL, device->receiveMessageCookie_, rc);
-							DEBUG_PRINTF("freespace_decode_message failed with code %d\n", rc);
-						}
-					}
+					freespace_private_routeMessage(&device->router_, device->id_, (uint8_t*) (s->readBuffer), (int) s->readBufferSize, device->hVer_,
+					                               device->receiveMessageCallback_, device->receiveMessageCookie_);
 				}
                 s->readStatus_ = FALSE;
             } else if (lastErr != ERROR_IO_INCOMPLETE) {
@@ -900,38 +891,30 @@ LIBFREESPACE_API int freespace_flush(FreespaceDeviceId id) {
     return FREESPACE_SUCCESS;
 }
 
+// Start or stop the pending receives after a callback change, depending
+// on whether any callback wants received reports now.
+static int updateAsyncReceives(struct FreespaceDeviceStruct* device, int wasAsync) {
+    if (!device->isOpened_ || wasAsync == isAsyncReceive(device)) {
+        return FREESPACE_SUCCESS;
+    }
+    if (wasAsync) {
+        // Deregistered the last callback, so stop any pending receives.
+        return terminateAsyncReceives(device);
+    }
+    // Registered the first callback, so initiate a receive.
+    return initiateAsyncReceives(device);
+}
+
 int freespace_private_setReceiveCallback(FreespaceDeviceId id,
                                          freespace_receiveCallback callback,
                                          void* cookie) {
     struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
     if (device == NULL) {
         return FREESPACE_ERROR_NO_DEVICE;
     }
 
-    if (device->isOpened_) {
-        if (device->receiveCallback_ != NULL && callback == NULL) {
-            // Deregistering callback, so stop any pending receives if no callbacks.
-            device->receiveCallback_ = NULL;
-            device->receiveCookie_ = NULL;
-
-            if (device->receiveMessageCallback_ == NULL) {
-                return terminateAsyncReceives(device);
-            } else {
-                return FREESPACE_SUCCESS;
-            }
-        } else if (device->receiveCallback_ == NULL && callback != NULL) {
-            // Registering a callback, so initiate a receive if there were no callbacks.
-            device->receiveCookie_ = cookie;
-            device->receiveCallback_ = callback;
-
-            if (device->receiveMessageCallback_ == NULL) {
-                return initiateAsyncReceives(device);
-            } else {
-                return FREESPACE_SUCCESS;
-            }
-        }
-    }
-    // Just update the cookie and callback.
+    wasAsync = isAsyncReceive(device);
     device->receiveCallback_ = callback;
     if (callback != NULL) {
         device->receiveCookie_ = cookie;
@@ -939,48 +922,218 @@ int freespace_private_setReceiveCallback(FreespaceDeviceId id,
         device->receiveCookie_ = NULL;
     }
 
-    return FREESPACE_SUCCESS;
+    return updateAsyncReceives(device, wasAsync);
 }
 
 LIBFREESPACE_API int freespace_setReceiveMessageCallback(FreespaceDeviceId id,
                                                         freespace_receiveMessageCallback callback,
                                                         void* cookie) {
     struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
     if (device == NULL) {
         return FREESPACE_ERROR_NO_DEVICE;
     }
 
-    if (device->isOpened_) {
-        if (device->receiveMessageCallback_ != NULL && callback == NULL) {
-            // Deregistering callback, so stop any pending receives if no callbacks.
-            device->receiveMessageCallback_ = NULL;
-            device->receiveMessageCookie_ = NULL;
-
-            if (device->receiveCallback_ == NULL) {
-                return terminateAsyncReceives(device);
-            } else {
-                return FREESPACE_SUCCESS;
-            }
-        } else if (device->receiveMessageCallback_ == NULL && callback != NULL) {
-            // Registering a callback, so initiate a receive if there were no callbacks.
-            device->receiveMessageCookie_ = cookie;
-            device->receiveMessageCallback_ = callback;
-
-            if (device->receiveCallback_ == NULL) {
-                return initiateAsyncReceives(device);
-            } else {
-                return FREESPACE_SUCCESS;
-            }
-        }
-    }
-    // Just update the cookie and callback.
+    wasAsync = isAsyncReceive(device);
     device->receiveMessageCallback_ = callback;
-    if (device->receiveMessageCallback_ != NULL) {
+    if (callback != NULL) {
         device->receiveMessageCookie_ = cookie;
     } else {
         device->receiveMessageCookie_ = NULL;
     }
 
+    return updateAsyncReceives(device, wasAsync);
+}
+
+LIBFREESPACE_API int freespace_setMessageFilter(FreespaceDeviceId id,
+                                                const struct FreespaceMessageMask* mask) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    freespace_private_setMessageFilter(&device->router_, mask);
     return FREESPACE_SUCCESS;
 }
 
+LIBFREESPACE_API int freespace_setMessageTypeCallback(FreespaceDeviceId id,
+                                                      int messageType,
+                                                      freespace_receiveMessageCallback callback,
+                                                      void* cookie) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
+    int rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    wasAsync = isAsyncReceive(device);
+    rc = freespace_private_setMessageTypeCallback(&device->router_, messageType, callback, cookie);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    return updateAsyncReceives(device, wasAsync);
+}
+
+LIBFREESPACE_API int freespace_subscribe(FreespaceDeviceId id,
+                                         const struct FreespaceMessageMask* mask,
+                                         freespace_subscriberCallback callback,
+                                         void* cookie) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
+    int subscription;
+    int rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    wasAsync = isAsyncReceive(device);
+    subscription = freespace_private_subscribe(&device->router_, mask, callback, cookie);
+    if (subscription < 0) {
+        return subscription;
+    }
+
+    rc = updateAsyncReceives(device, wasAsync);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+    return subscription;
+}
+
+LIBFREESPACE_API int freespace_subscribeQueue(FreespaceDeviceId id,
+                                              const struct FreespaceMessageMask* mask,
+                                              int depth) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
+    int subscription;
+    int rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    wasAsync = isAsyncReceive(device);
+    subscription = freespace_private_subscribeQueue(&device->router_, mask, depth);
+    if (subscription < 0) {
+        return subscription;
+    }
+
+    rc = updateAsyncReceives(device, wasAsync);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+    return subscription;
+}
+
+LIBFREESPACE_API int freespace_unsubscribe(FreespaceDeviceId id, int subscription) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    int wasAsync;
+    int rc;
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    wasAsync = isAsyncReceive(device);
+    rc = freespace_private_unsubscribe(&device->router_, subscription);
+    if (rc != FREESPACE_SUCCESS) {
+        return rc;
+    }
+
+    return updateAsyncReceives(device, wasAsync);
+}
+
+LIBFREESPACE_API int freespace_popMessage(FreespaceDeviceId id,
+                                          int subscription,
+                                          const struct freespace_message** message) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    return freespace_private_popMessage(&device->router_, subscription, message);
+}
+
+LIBFREESPACE_API int freespace_getDroppedMessages(FreespaceDeviceId id,
+                                                  int subscription,
+                                                  uint32_t* dropped) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    return freespace_private_getDroppedMessages(&device->router_, subscription, dropped);
+}
+
+LIBFREESPACE_API int freespace_drainMessages(FreespaceDeviceId id,
+                                             int subscription,
+                                             freespace_subscriberCallback callback,
+                                             void* cookie) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    return freespace_private_drainMessages(&device->router_, id, subscription, callback, cookie);
+}
+
+LIBFREESPACE_API int freespace_acquireMessage(FreespaceDeviceId id,
+                                              const struct freespace_message* message) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    return freespace_private_acquireMessage(&device->router_, message);
+}
+
+LIBFREESPACE_API int freespace_releaseMessage(FreespaceDeviceId id,
+                                              const struct freespace_message* message) {
+    struct FreespaceDeviceStruct* device = freespace_private_getDeviceById(id);
+    if (device == NULL) {
+        return FREESPACE_ERROR_NO_DEVICE;
+    }
+
+    return freespace_private_releaseMessage(&device->router_, message);
+}
+
+
+LIBFREESPACE_API int freespace_setReceiveQueueSize(FreespaceDeviceId id,
+                                                   int size,
+                                                   int flags) {
+    // Reports are buffered by the HID class driver.
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_getReceiveStats(FreespaceDeviceId id,
+                                               struct FreespaceReceiveStats* stats) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_setSendPipelineDepth(FreespaceDeviceId id, int depth) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_setSendTimeout(FreespaceDeviceId id, unsigned int timeoutMs) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_cancelSends(FreespaceDeviceId id) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_borrowReport(FreespaceDeviceId id,
+                                            unsigned int timeoutMs,
+                                            struct FreespaceReportBuffer* report) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_releaseReport(FreespaceDeviceId id,
+                                             struct FreespaceReportBuffer* report) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
+
+LIBFREESPACE_API int freespace_addReceiveBuffers(FreespaceDeviceId id,
+                                                 uint8_t* buffers,
+                                                 int count) {
+    return FREESPACE_ERROR_UINIMPLEMENTED;
+}
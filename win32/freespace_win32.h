@@ -24,6 +24,7 @@
 #include "freespace/freespace.h"
 #include "freespace/freespace_codecs.h"
 #include "freespace/freespace_deviceTable.h"
+#include "freespace_router.h"
 
 // Define our debug printf statements
 #ifdef DEBUG
@@ -244,6 +245,9 @@ struct FreespaceDeviceStruct {
     // The cookie passed to the receive struct callback.
     void*                             receiveMessageCookie_;
 
+    // Message filter and per-type callbacks.
+    struct FreespaceMessageRouter     router_;
+
     // Send events outstanding
     struct FreespaceSendStruct  send_[FREESPACE_MAXIMUM_SEND_MESSAGE_COUNT];
 };